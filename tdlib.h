@@ -14,6 +14,12 @@
    All other files should include this header normally, without defining
    TDLIB_IMPLEMENTATION.
 
+   The implementation needs POSIX.1-2008 (pread, fseeko, clock_gettime),
+   which a strict -std=c99 or -std=c11 hides. The header asks for it when
+   TDLIB_IMPLEMENTATION is defined, but that only works if no system header
+   came before it. In a strict build include tdlib.h first in that file, or
+   define _DEFAULT_SOURCE or _POSIX_C_SOURCE yourself.
+
    This library does not imply warranty.
 
    A guided overview of the library is provided in PRIMER. This is not an
@@ -76,6 +82,31 @@
    There are also aliases like global_variable, local_persist and internal. They
    all expand to static. They don't change any behavior. They make the intent
    obvious.
+
+   Atomics
+   -------
+   Every compiler spells atomics differently, so the header spells them once.
+   GCC and Clang get the __atomic builtins, MSVC gets the Interlocked
+   intrinsics. There are three types, TD_Atomic_U32, TD_Atomic_U64 and
+   TD_Atomic_Ptr, which are plain volatile integers and pointers. Nothing stops
+   you from touching them directly. Don't.
+
+   td_atomic_load_T(p, order)
+   td_atomic_store_T(p, value, order)
+   td_atomic_exchange_T(p, value, order)       returns the old value
+   td_atomic_cas_T(p, &expected, desired, order)
+   td_atomic_fetch_add_T(p, value, order)      returns the old value
+
+   T is u32, u64 or ptr. There is no fetch_add for pointers. cas is the strong
+   variant. It returns true on success and writes the current value to
+   expected on failure, same as C11.
+
+   order is one of TD_RELAXED, TD_ACQUIRE, TD_RELEASE, TD_ACQ_REL and
+   TD_SEQ_CST. If you don't know which one you need, you need TD_SEQ_CST. On
+   MSVC every read-modify-write is a full barrier regardless.
+
+   td_atomic_fence(order) is a standalone fence. td_cpu_relax() is the pause
+   instruction for spin loops, pause on x86 and yield on ARM.
    
    Vector
    ------
@@ -144,6 +175,659 @@
    td_string_view_trim, td_string_view_slice]
 
    You can read a complete file into a string buffer. [td_read_file_to_string]
+
+   Writer
+   ------
+   TD_Writer is the other half of td_read_file_to_string. It batches small
+   pieces of output into one buffer of TD_WRITERSZ bytes and hands them to the
+   OS in a single call. Writing every little piece with its own fwrite is
+   slow. Don't.
+
+   A writer targets either a file descriptor or a FILE*:
+
+   TD_Writer w;
+   td_writer_init_fd(&w, 1);
+   td_writer_write_cstr(&w, "hello ");
+   td_writer_write_view(&w, name);
+   td_writer_close(&w);
+
+   Pieces that don't fit in what's left of the buffer are not copied. The
+   pending buffer and the piece go out together with writev. If you already
+   have an array of views, td_writer_write_views gathers all of them the same
+   way.
+
+   A short write is not an error. Pipes and sockets take what they have room
+   for; the writer goes on from where the kernel stopped, in the middle of a
+   piece if need be, until everything is out. EINTR is retried the same way.
+
+   td_writer_close flushes and frees the buffer. It does not close the fd or
+   the FILE*. You opened it, you close it.
+
+   Errors are sticky. Once a write fails, every later call returns false and
+   does nothing. Check the return value of td_writer_close if you check
+   anything at all.
+
+   Copying Files
+   -------------
+   Reading a file into a TD_String only to write it out again is a waste of
+   two copies. td_copy_fd moves bytes from one descriptor to another without
+   pulling them into user space when the OS lets us.
+
+   On Linux we try copy_file_range (file to file), then sendfile (file to
+   anything, sockets included), then splice (pipes). Whatever the kernel
+   refuses falls through to the next one, and the last resort is a plain
+   read/write loop with a TD_WRITERSZ buffer. Other platforms go straight to
+   the loop.
+
+   td_copy_fd copies count bytes, or everything up to end of file when count
+   is negative. It returns the number of bytes copied or -1 on error. It starts
+   at the current offsets of both descriptors and advances them.
+
+   td_copy_file copies a file by path. The destination is truncated and gets
+   the mode of the source.
+
+   Following Files
+   ---------------
+   Re-reading a growing log file from the start on every poll does work
+   proportional to the whole file. TD_Follower remembers where it stopped and
+   only appends what was written since.
+
+   TD_Follower f;
+   td_follower_open(&f, "app.log");
+   for (;;) {
+       td_follower_wait(&f, &buf, -1);
+       ... consume buf ...
+   }
+   td_follower_close(&f);
+
+   td_follower_read appends whatever is new and returns immediately.
+   td_follower_wait blocks until there is something new or timeout_ms passes
+   (negative means forever), then reads. Both return the number of bytes
+   appended or -1 on error. Following starts at offset 0. Set f.offset
+   yourself after opening if you want to skip what's already there.
+
+   On Linux the wait sleeps on inotify. Elsewhere, or when inotify is not
+   available, it polls every TD_FOLLOWPOLLMS milliseconds. Rotation is
+   detected either way because the path is checked on every wakeup.
+
+   If the file shrinks below the offset, it was truncated and we start over
+   from 0. If the path points to a different file, it was rotated: the rest of
+   the old file is read first, then we switch to the new one. Data already
+   appended to your string is never touched.
+
+   Saving and Loading Vectors
+   --------------------------
+   A vector of plain structs can be written to disk as is and brought back
+   without parsing anything.
+
+   td_vec_save(&v, "index.bin", 3);
+   td_vec_load(&v, "index.bin", 3);
+
+   The file is a 64 byte header (magic, your version, element size, count)
+   followed by the raw elements. Load refuses files whose version or element
+   size doesn't match. The bytes are native endian and the structs are native
+   layout. Don't ship these files across machines. Don't put pointers in the
+   structs.
+
+   td_vec_load reads straight into the vector's buffer, growing it the same
+   way td_vec_append does. td_vec_map doesn't read at all, it maps the file
+   and points the vector into the mapping:
+
+   TD_Mapping m;
+   if (td_vec_map(&v, "index.bin", 3, &m)) {
+       ... read v.data[0 .. v.size) ...
+       td_unmap(&m);
+   }
+
+   A mapped vector is read-only. Don't write to it and don't free it. Its
+   alloc is 0, which tells the vector macros the buffer isn't theirs:
+   appending to it panics and td_vec_try_reserve fails with EINVAL. td_unmap
+   releases it and the vector is dangling after that. The header is 64 bytes
+   so the elements are as aligned as the mapping is.
+
+   td_vec_map frees the buffer the vector owned (alloc != 0) before it maps,
+   so mapping over a loaded or appended vector doesn't leak. It doesn't know
+   about budgets or old mappings: td_vec_release a budgeted vector and
+   td_unmap a mapped one yourself first.
+
+   All three return false on failure. A failed load or map leaves the vector
+   empty; load keeps the buffer it had, map has freed it.
+
+   Cache Hints
+   -----------
+   By default the kernel guesses how you read a file. For bulk ingest it
+   guesses wrong: a one-shot scan of a big file pushes your hot working set out
+   of the page cache. Tell it what you're doing.
+
+   TD_HINT_SEQUENTIAL  read front to back, read ahead aggressively
+   TD_HINT_WILLNEED    start reading the whole thing in now
+   TD_HINT_DONTNEED    drop the pages once we're done with them
+   TD_HINT_DIRECT      bypass the page cache entirely (O_DIRECT)
+
+   td_file_advise applies hints to any descriptor. td_read_file_to_string_ex
+   is td_read_file_to_string with hints. td_read_path_to_string opens the file
+   itself, which is the only way TD_HINT_DIRECT can work, since the flag has
+   to be given at open time. Direct reads go through an aligned buffer of
+   TD_DIRECTSZ bytes. If the filesystem refuses O_DIRECT, at open or at the
+   first read, we quietly read the normal way and drop the pages afterwards
+   instead.
+
+   These are hints. posix_fadvise where it exists, F_NOCACHE and F_RDAHEAD on
+   macOS, nothing on Windows.
+
+   Jobs
+   ----
+   A job is a function pointer and an argument. A TD_Job_Pool runs jobs on a
+   set of worker threads, pthreads on POSIX and Win32 threads on Windows.
+
+   TD_Job_Pool *pool = td_job_pool_create(0);   // 0 means one per cpu
+   TD_Job_Group group = {0};
+   td_job_submit(pool, &group, work, arg);
+   td_job_submit(pool, &group, work, other_arg);
+   td_job_wait(pool, &group);
+   td_job_pool_destroy(pool);
+
+   A group is a counter of unfinished jobs. td_job_wait returns when it drops
+   to zero. The waiting thread doesn't sit idle, it runs queued jobs until its
+   own are done. Groups are optional, pass NULL if you don't care.
+
+   Every worker owns a Chase-Lev deque of TD_JOBDEQUESZ jobs. Jobs submitted
+   from inside a job go on the submitting worker's own deque, where it pops
+   them LIFO. Idle workers steal from the other end of somebody else's deque.
+   Jobs submitted from outside the pool go through one shared, locked queue.
+   If a worker's deque is full, the job runs right away on the submitting
+   thread.
+
+   td_parallel_for splits [begin, end) into chunks of grain indices and calls
+   fn(chunk_begin, chunk_end, arg) for each of them. Chunks are handed out
+   from a shared counter, so fast threads take more of them. The caller works
+   too and returns once everything is done.
+
+   td_job_pool_destroy runs whatever is still queued before it returns.
+
+   Queues
+   ------
+   Two bounded lock-free ring queues for handing things between threads. Like
+   vectors, you declare the struct for your element type and the macros do
+   the rest.
+
+   struct spsc_T {                         struct mpmc_T {
+       T *data;                                struct { TD_Atomic_U64 seq; T item; } *data;
+       size_t alloc;                           size_t alloc;
+       TD_Ring_Index head, tail;               TD_Ring_Index head, tail;
+   };                                      };
+
+   SPSC is one producer and one consumer, the shape of a pipeline stage. MPMC
+   is any number of either, a Vyukov bounded queue with a sequence number per
+   cell. Don't use SPSC from more than one producer or consumer. It will
+   appear to work. It doesn't.
+
+   td_spsc_init(&q, 1024);                 // rounded up to a power of two
+   td_spsc_push(&q, item, ok);             // ok is false when full
+   td_spsc_pop(&q, out, ok);               // ok is false when empty
+   td_spsc_push_bulk(&q, items, n, done);  // done is how many went in
+   td_spsc_pop_bulk(&q, items, n, done);   // done is how many came out
+   td_spsc_free(&q);
+
+   The td_mpmc_ family has the same shape. SPSC bulk operations publish the
+   whole batch with a single store. MPMC bulk operations are a loop over the
+   single ones that stops at the first failure.
+
+   TD_Ring_Index puts each index on its own cache line together with the
+   owner's cached copy of the other index. The producer only looks at the
+   consumer's line when its cached view says the queue is full, and the other
+   way around.
+
+   Locks
+   -----
+   pthread_mutex_t is forty bytes of policy you mostly don't need. These are
+   one or two u32s each, zero initialized, and they talk to the kernel only
+   when somebody actually has to sleep. Uncontended lock and unlock are one
+   atomic instruction each.
+
+   TD_Mutex       td_mutex_lock, td_mutex_trylock, td_mutex_unlock
+   TD_Event       td_event_set, td_event_reset, td_event_wait
+   TD_Semaphore   td_semaphore_post, td_semaphore_wait, td_semaphore_trywait
+   TD_RWLock      td_rwlock_read_lock, td_rwlock_read_unlock,
+                  td_rwlock_write_lock, td_rwlock_write_unlock
+
+   A contended mutex spins TD_SPINCOUNT times before it sleeps. An event stays
+   set until td_event_reset, unless you set auto_reset in which case each set
+   releases exactly one waiter. The rwlock prefers readers. A steady stream of
+   them will starve a writer. None of these are recursive and none of them
+   know who owns them.
+
+   Sleeping is a futex on Linux, WaitOnAddress on Windows (link against
+   synchronization.lib), __ulock_wait on macOS and a small table of pthread
+   mutexes and condition variables keyed by address everywhere else.
+
+   Arenas and Scratch
+   ------------------
+   A TD_Arena is one big reservation of address space. Allocating from it is a
+   pointer bump. Freeing is resetting the pointer. The reservation is
+   inaccessible and costs nothing; pages are committed 64 KiB at a time as
+   the arena grows, so it works with overcommit turned off, and only backed
+   by memory once they're touched.
+
+   TD_Arena arena;
+   td_arena_init(&arena, 1 << 30);
+   Node *n = td_arena_push(&arena, sizeof(Node));
+   td_arena_free(&arena);
+
+   td_arena_push returns memory aligned to 16 bytes and panics when the
+   reservation runs out. Nothing is zeroed.
+
+   Every thread also has two scratch arenas for temporaries. A scratch scope
+   remembers where the arena was and puts it back when it ends:
+
+   TD_Scratch scratch = td_scratch_begin(NULL, 0);
+   ... td_arena_push(scratch.arena, ...) ...
+   td_scratch_end(scratch);
+
+   If your function was handed an arena to put its results in, and that arena
+   might itself be a scratch arena, pass it as a conflict. You get the other
+   one, and your temporaries don't end up under the caller's results:
+
+   TD_Scratch scratch = td_scratch_begin(&out_arena, 1);
+
+   Two are enough for any depth, because every level only needs to avoid the
+   one arena its caller writes to.
+
+   A thread's scratch arenas are reserved on its first td_scratch_begin and
+   stay until it calls td_scratch_thread_release, with no scope open. Do
+   that before a thread you started exits, or its memory is lost for good.
+
+   Vectors and strings can live in an arena too. Use td_vec_append_arena and
+   td_vec_append_bulk_arena instead of the plain macros. When the vector is the
+   last thing pushed onto the arena it grows in place, otherwise it moves to
+   the top. Never TD_FREE such a vector and never pass it to the plain append
+   macros. It goes away with the arena or the scratch scope.
+
+   Pools and Slabs
+   ---------------
+   Lots of small objects of the same size are what malloc is worst at. There
+   are two answers here.
+
+   TD_Pool hands out objects of one size. Freed objects go on an intrusive
+   free list and come back first. td_pool_release frees every object at once,
+   which is how you should be tearing down a tree anyway.
+
+   TD_Pool pool;
+   td_pool_init(&pool, sizeof(Node));
+   Node *n = td_pool_get(&pool);
+   td_pool_put(&pool, n);
+   td_pool_release(&pool);
+
+   A pool is not thread safe. Objects are aligned to 16 bytes if the object
+   size is at least 16, and to pointer size otherwise.
+
+   td_slab_alloc, td_slab_realloc and td_slab_free are a general allocator
+   with the same shape as malloc, realloc and free, so they drop straight into
+   the vector hooks:
+
+   #define TD_MALLOC(sz)       td_slab_alloc(sz)
+   #define TD_REALLOC(ptr, sz) td_slab_realloc((ptr), (sz))
+   #define TD_FREE(p)          td_slab_free(p)
+
+   Requests up to 2 KiB are rounded up to one of 14 size classes and served
+   from TD_SLABSZ byte slabs, each slab holding blocks of a single class.
+   Bigger requests go to malloc. Every thread keeps up to TD_SLABCACHE free
+   blocks per class for itself, so most allocations and frees touch nothing
+   shared. Define TD_SLABCACHE to 0 to turn that off. Threads that exit with a
+   full cache should call td_slab_thread_flush first, otherwise those blocks
+   are gone for good.
+
+   Slabs are carved from one reservation of TD_SLABRESERVE bytes. That's how a
+   free finds its size class without a header on every block, and why slab
+   memory is never returned to the OS.
+
+   Allocation Statistics
+   ---------------------
+   Define TDLIB_ALLOCSTATS before including the header, in every file, and
+   TD_MALLOC, TD_REALLOC and TD_FREE start keeping books. Every allocation
+   is charged to the file and line that made it. For vectors that's the line
+   of the td_vec_append, since the macros expand right there.
+
+   What gets recorded:
+   - allocation, reallocation and free counts, total and live bytes, peak
+   - a histogram of request sizes in powers of two
+   - bytes copied by reallocs that moved the block
+   - per call site: allocations, bytes, what is still live
+   - per call site: slack, the bytes a vector grew past what it asked for
+
+   td_alloc_stats_text(fp) and td_alloc_stats_json(fp) dump all of it. Live
+   bytes at exit are your leaks, with the line that leaked them.
+   td_vec_slack(&v) is the number of bytes v holds and doesn't use right now,
+   and works with or without stats.
+
+   It costs a 16 byte header per block and a global lock per call. It's for
+   finding out, not for production. If you defined your own TD_MALLOC and
+   friends, they are left alone and nothing is recorded. The slab allocator
+   and arenas are not counted either; they don't go through the hooks.
+
+   Budgets and Fallible Allocation
+   -------------------------------
+   The plain vector macros call TD_PANIC when memory runs out. That is the
+   right call for a tool and the wrong one for a server, where one runaway
+   request shouldn't take everybody else down with it.
+
+   The try variants return false instead of panicking:
+
+   if (!td_vec_try_append(&v, item, &budget)) return reject(request);
+   td_vec_try_append_bulk(&v, items, count, &budget)
+   td_vec_try_reserve(&v, capacity, &budget)
+   td_try_read_file_to_string(&str, fp, &budget)
+
+   A TD_Budget is a byte limit that any number of containers charge their
+   growth against, from any number of threads:
+
+   TD_Budget budget = { .limit = 64 << 20 };
+
+   A vector that was grown against a budget must be freed with
+   td_vec_release(&v, &budget), which gives its bytes back. Mixing budgeted
+   and unbudgeted growth on one vector gets the accounting wrong. Pass NULL
+   for no budget; the try variants then only fail when TD_REALLOC does.
+
+   On failure errno is ENOBUFS if the budget said no and ENOMEM if the
+   allocator did. The vector is left as it was. The fast path is the same
+   capacity check the plain macros do; everything else is out of line.
+
+   Aligned and Huge Allocations
+   ----------------------------
+   malloc gives you 16 byte alignment and 4 KiB pages. SIMD loops want 64 byte
+   alignment, and a scan over a gigabyte of 4 KiB pages spends its time in
+   TLB misses.
+
+   td_aligned_alloc, td_aligned_realloc and td_aligned_free take an alignment
+   (a power of two, at least 16) and otherwise behave like the malloc family.
+   They fit the vector hooks:
+
+   #define TD_MALLOC(sz)       td_aligned_alloc((sz), TD_CACHELINE)
+   #define TD_REALLOC(ptr, sz) td_aligned_realloc((ptr), (sz), TD_CACHELINE)
+   #define TD_FREE(p)          td_aligned_free(p)
+
+   Every vector's data is then cache line aligned. Blocks carry a 16 byte
+   header in front, so only td_aligned_free may free them.
+
+   Huge pages are opt in. td_huge_pages(TD_HUGE_THP) maps every block of at
+   least TD_HUGESZ bytes on a 2 MiB boundary and asks for transparent huge
+   pages with madvise. td_huge_pages(TD_HUGE_TLB) asks for MAP_HUGETLB first,
+   which only works if the admin reserved huge pages, and falls back to THP.
+   td_huge_pages(TD_HUGE_OFF) goes back to malloc. This is Linux only; other
+   platforms always get the malloc path.
+
+   String Pools
+   ------------
+   td_string_clear frees the buffer. If you are about to fill the same string
+   again, use td_string_reset instead. It sets the size to zero and keeps the
+   capacity.
+
+   When strings come and go with requests, keep their buffers in a
+   TD_String_Pool. td_string_pool_get hands out an empty string with at least
+   the capacity you asked for, reusing a returned buffer when there is one.
+   td_string_pool_put takes the buffer back and leaves the string empty.
+
+   TD_String_Pool pool;
+   td_string_pool_init(&pool, 1 << 20);
+   TD_String s = td_string_pool_get(&pool, 256);
+   td_string_append_cstr(&s, "hello");
+   td_string_pool_put(&pool, &s);
+   td_string_pool_release(&pool);
+
+   Buffers are kept by capacity class, one class per power of two. The pool
+   keeps at most the given number of bytes; anything over that is freed on
+   put. Once the pool has warmed up, a steady stream of requests makes no
+   string allocations at all. A pool is not thread safe. Use one per thread.
+
+   CPU Features and Dispatch
+   -------------------------
+   Compiling for the lowest common denominator leaves AVX2 on the table;
+   compiling with -mavx2 crashes on the one box that doesn't have it. So the
+   library is compiled for the baseline and looks at the CPU once at run time.
+
+   td_cpu_features returns a mask of TD_CPU_* bits: SSE2, SSE4.2, POPCNT,
+   AVX2, BMI2, AVX-512F and AVX-512BW on x86, NEON on ARM. The first call runs
+   cpuid (and checks that the OS saves the wide registers); later calls just
+   load the cached mask. td_cpu_has(TD_CPU_AVX2 | TD_CPU_BMI2) is true only if
+   all of them are there.
+
+   Kernels that care are compiled once per instruction set and picked through
+   a function pointer table the first time any of them is called. Nothing is
+   checked per call after that. td_string_view_count and td_string_view_chop
+   go through it today. Your own kernels can do the same thing: mark the wide
+   version with TD_TARGET("avx2") so it compiles without -mavx2, and pick it
+   once with td_cpu_has.
+
+   TD_TARGET("avx2") static void sum_avx2(...);
+   static void sum_scalar(...);
+   static void (*sum)(...);
+   ...
+   sum = td_cpu_has(TD_CPU_AVX2) ? sum_avx2 : sum_scalar;
+
+   Hints
+   -----
+   The compilers all have ways to be told things, and they all spell them
+   differently. These macros spell them once:
+
+   TD_LIKELY(x), TD_UNLIKELY(x)   which way a branch usually goes
+   TD_FORCE_INLINE                inline this, really
+   TD_NOINLINE, TD_COLD           keep this out of the caller, it's rare
+   TD_RESTRICT                    this pointer doesn't alias the others
+   TD_PREFETCH(p)                 start loading p into cache now
+   TD_ASSUME_ALIGNED(p, n)        p is aligned to n, vectorise accordingly
+
+   Where a compiler has no such thing the macro does nothing. They are hints;
+   get one wrong and the code is slower, not broken. Use them where a profile
+   says so, not everywhere.
+
+   The library uses them itself. Vector growth is a cold out of line call, so
+   an append site is a compare, a store and an increment.
+
+   Timers
+   ------
+   td_time_now_ns is a monotonic clock in nanoseconds: clock_gettime on
+   POSIX, mach_absolute_time on macOS, QueryPerformanceCounter on Windows. It
+   costs some tens of nanoseconds and never goes backwards. Use it.
+
+   td_cycles is the raw counter: rdtsc on x86, cntvct on ARM64, and the clock
+   above anywhere else. It is a single instruction and is not ordered against
+   the code around it, so it's for loops of many iterations, not for timing
+   one load. td_cycles_hz says how fast it ticks: ARM64 reports that itself,
+   on x86 it is measured against the clock for 10ms on the first call.
+   td_cycles_to_ns converts. On an old x86 without an invariant TSC the
+   count follows the clock speed and the conversion is a guess.
+
+   TD_Stopwatch sw = {0};
+   td_stopwatch_start(&sw);
+   work();
+   td_stopwatch_stop(&sw);
+   printf("%llu ns\n", (unsigned long long)td_stopwatch_ns(&sw));
+
+   Start and stop as often as you like; a stopwatch adds up the time it ran.
+   td_stopwatch_ns on a running stopwatch includes the current lap.
+
+   Benchmarks
+   ----------
+   td_bench_run times fn(arg, iters), a function that does the thing iters
+   times. It first runs it with growing iteration counts until one run takes
+   TD_BENCHSAMPLENS; that is the warmup and it picks iters. Then it takes
+   TD_BENCHSAMPLES samples of that many iterations and reports min, median,
+   p90, p99 and max per iteration, and bytes per second if you said how many
+   bytes one iteration touches.
+
+   static void bench_trim(void *arg, u64 iters) {
+       TD_String_View *v = arg;
+       for (u64 i = 0; i < iters; i++) {
+           TD_String_View t = td_string_view_trim(*v);
+           td_do_not_optimize(&t);
+       }
+   }
+
+   TD_Bench_Result r = td_bench_run("trim/64", bench_trim, &view, 64);
+   td_bench_print(stdout, &r);
+
+   The compiler will delete work whose result nobody looks at.
+   td_do_not_optimize(p) tells it that p and what it points to are looked at.
+   td_clobber() tells it all of memory is. Neither emits an instruction.
+
+   td_bench_print_json writes one result as one line of JSON. Save a run, make
+   your change, run again and diff. Sort by name if you filtered differently.
+
+   Time says how slow, not why. td_bench_counters(true) makes every later
+   td_bench_run also read the hardware counters over its samples: cycles,
+   instructions, branch misses, L1 data read misses and last level cache
+   misses, all per iteration. The text output adds IPC and the misses, the
+   JSON adds every counter. This is Linux only and goes through
+   perf_event_open, kernel excluded, so perf_event_paranoid up to 2 is fine.
+   A counter the kernel or the VM won't give you is reported as -1, and if
+   none can be opened the result is just the times. Counts are scaled when
+   the kernel had to multiplex them.
+
+   The library's own suite lives in this file. Build it by compiling the
+   header itself:
+
+   cc -O2 -x c -DTDLIB_IMPLEMENTATION -DTDLIB_BENCH_MAIN tdlib.h -o tdbench -lpthread
+   ./tdbench                  # everything, as a table
+   ./tdbench --json chop      # the chop benchmarks, as JSON lines
+   ./tdbench --counters trim  # with hardware counters
+
+   Tests
+   -----
+   The parts that are easy to get subtly wrong come with checks, also in this
+   file. Build them the same way, with TDLIB_TEST_MAIN instead of
+   TDLIB_BENCH_MAIN, and run them under the sanitizers:
+
+   cc -g -fsanitize=address,undefined -x c -DTDLIB_IMPLEMENTATION \
+      -DTDLIB_TEST_MAIN tdlib.h -o tdtest -lpthread
+   ./tdtest                   # everything
+   ./tdtest aligned           # the tests with aligned in their name
+
+   A failed check prints where it is and the exit status is 1.
+
+   Profiling Zones
+   ---------------
+   A zone is a named stretch of code on one thread. Mark them and you get a
+   timeline you can open in chrome://tracing or Perfetto, without a profiler.
+
+   td_zone_begin("parse");
+   parse(input);
+   td_zone_end();
+
+   td_zone("render") {
+       render(frame);
+   }
+
+   td_zone is the same pair around a block. Don't break, goto or return out
+   of it; the end is never recorded and the rest of that thread's timeline is
+   off by one level. Zones nest. Names must outlive the dump, so use string
+   literals.
+
+   Define TDLIB_PROFILE before including the header, in every file you want
+   zones in, and they are recorded. Without it the macros are gone and cost
+   nothing. Each zone is two td_cycles reads and two appends to a vector
+   owned by the thread. Nothing is shared and nothing is locked; a thread
+   only touches the global list once, to add its buffer to it.
+
+   td_profile_dump(fp) writes everything recorded so far as Chrome trace JSON
+   and td_profile_reset drops it. Call them while no other thread is inside a
+   zone. Buffers of threads that exited stay and are dumped too.
+
+   Histograms
+   ----------
+   Keeping every latency sample in a vector to sort it later is how you run
+   out of memory at the worst moment. TD_Histogram counts values in
+   log-linear buckets instead: exact below 2^TD_HISTBITS, and above that
+   every power of two is split into 2^TD_HISTBITS equal buckets. With the
+   default of 7 a value is off by at most 1 part in 128, from 1 to 2^64.
+
+   TD_Histogram *h = TD_MALLOC(sizeof(*h));
+   td_histogram_init(h);
+   td_histogram_record(h, td_time_now_ns() - start);
+   u64 p99 = td_histogram_percentile(h, 99.0);
+   td_histogram_print(stdout, h);
+
+   Recording finds the bucket with one count-leading-zeros and bumps a
+   counter. No allocation, no loop. The struct is a fixed array of counters,
+   about 60 KiB at the default, so don't put it on a small stack.
+
+   A histogram is not thread safe. Give every thread its own and
+   td_histogram_merge them into one when you want the answer; merging is
+   exact. td_histogram_percentile returns the largest value that falls in
+   the same bucket as the one asked for, never more than the max recorded.
+   td_histogram_print writes the usual percentiles and
+   td_histogram_print_json writes those plus every non-empty bucket.
+
+   Metrics
+   -------
+   A counter every worker bumps is a cache line every worker fights over.
+   TD_Counter is split into TD_COUNTERSHARDS shards, one cache line each.
+   A thread picks a shard the first time it counts anything and sticks to
+   it; reading adds all shards up. Adding is a relaxed atomic add on a line
+   that, with no more threads than shards, nobody else writes.
+
+   global_variable TD_Counter requests;
+   td_counter_register(&requests, "server.requests");
+   td_counter_add(&requests, 1);
+   u64 n = td_counter_read(&requests);
+
+   TD_Gauge is the same thing for a value that goes up and down, like the
+   number of open connections: td_gauge_add takes a signed delta and
+   td_gauge_read returns the signed sum. There is no set, since a sharded
+   value can't be set.
+
+   Registered counters and gauges are dumped by td_metrics_dump(fp), one
+   "name value" line each. Register each one once and keep it alive for
+   good; statics and globals are the natural place. A zero initialised
+   counter is ready to use with or without registering it.
+
+   Define TDLIB_METRICS before including the header, in every file, and
+   the library counts a few things of its own: vector growths and the bytes
+   they added (vec.grows, vec.grow_bytes), bytes read by the file reading
+   functions and the follower (io.bytes_read) and bytes written by writers
+   (io.bytes_written). Vector growth is counted in the file that appends, so
+   a file without it doesn't count its vectors. Without it these counters
+   are still registered and stay at 0. Vectors grown through the arena
+   macros are not counted.
+
+   Parsing Numbers
+   ---------------
+   strtol wants a null-terminated string, so parsing a view with it means
+   copying the view first. Don't. The td_string_view_parse_* functions read
+   straight from the view and, like td_string_view_chop, move it past what
+   they consumed:
+
+   TD_String_View line = td_string_view_from_cstr("42,-7");
+   i64 a, b;
+   td_string_view_parse_i64(&line, &a);     // line is now ",-7"
+   td_string_view_chop(&line, ',');
+   td_string_view_parse_i64(&line, &b);
+
+   The accepted text is an optional sign and decimal digits, nothing else. No
+   leading whitespace, no 0x, no locale; trim first if you need to. A '-' on
+   an unsigned parse is an error, not a wrap around.
+
+   They return false and leave the view and the output alone if there are no
+   digits (errno is EINVAL) or the number doesn't fit (errno is ERANGE).
+
+   Digits are taken eight at a time: eight bytes are loaded as one 64 bit
+   word, checked to all be digits and turned into a number with three
+   multiplies, without a loop. Long numbers cost about as much as short
+   ones.
+
+   td_string_view_parse_f64 and td_string_view_parse_f32 do the same for
+   floating point: an optional sign, digits with an optional '.', and an
+   optional exponent, or inf, infinity and nan in any case. The decimal point
+   is always '.', whatever the locale says. Hex floats are not accepted. The
+   result is correctly rounded, the same bits strtod gives you in the C
+   locale. Too big is infinity and too small is zero; that's rounding, not an
+   error. They fail with EINVAL only if there are no digits.
+
+   Up to 19 significant digits, which is every float anyone prints, take
+   the Eisel-Lemire path: the digits times a 128 bit power of five from a
+   table, and a few shifts. Longer inputs are cut to 19 digits and rounded
+   twice, once rounding the cut digits down and once up. If both agree, that
+   is the answer. If not, which takes a number sitting right on a rounding
+   boundary, the view is copied and handed to strtod.
  */
 
 #ifndef TD_LIBDEF
@@ -154,6 +838,16 @@
 #    endif
 #endif
 
+/* The few variables the header refers to follow TDLIB_STATIC like the
+   functions do. Declared with TD__VARDECL, defined with TD__VARDEF. */
+#ifdef TDLIB_STATIC
+#    define TD__VARDECL static
+#    define TD__VARDEF  static
+#else
+#    define TD__VARDECL extern
+#    define TD__VARDEF
+#endif
+
 #if defined __clang__
 #    define COMPILER_CLANG
 #elif defined _MSC_VER
@@ -178,10 +872,75 @@
 #    define PLATFORM_POSIX
 #endif
 
+#if defined __x86_64__ || defined _M_X64
+#    define ARCH_X64
+#elif defined __i386__ || defined _M_IX86
+#    define ARCH_X86
+#elif defined __aarch64__ || defined _M_ARM64
+#    define ARCH_ARM64
+#elif defined __arm__ || defined _M_ARM
+#    define ARCH_ARM
+#endif
+
+/* MSVC compiles any intrinsic without flags, so there is nothing to say */
+#if defined COMPILER_GNU || defined COMPILER_CLANG
+#    define TD_TARGET(isa) __attribute__((target(isa)))
+#else
+#    define TD_TARGET(isa)
+#endif
+
+#if defined COMPILER_GNU || defined COMPILER_CLANG
+#    define TD_LIKELY(x)             __builtin_expect(!!(x), 1)
+#    define TD_UNLIKELY(x)           __builtin_expect(!!(x), 0)
+#    define TD_FORCE_INLINE          inline __attribute__((always_inline))
+#    define TD_NOINLINE              __attribute__((noinline))
+#    define TD_COLD                  __attribute__((cold))
+#    define TD_RESTRICT              __restrict
+#    define TD_PREFETCH(p)           __builtin_prefetch((p))
+#    define TD_ASSUME_ALIGNED(p, n)  __builtin_assume_aligned((p), (n))
+#    define TD__UNUSED               __attribute__((unused))
+#elif defined COMPILER_MS
+#    define TD_LIKELY(x)             (x)
+#    define TD_UNLIKELY(x)           (x)
+#    define TD_FORCE_INLINE          __forceinline
+#    define TD_NOINLINE              __declspec(noinline)
+#    define TD_COLD
+#    define TD_RESTRICT              __restrict
+#    if defined _M_ARM64 || defined _M_ARM
+#        define TD_PREFETCH(p)       __prefetch((p))
+#    else
+#        define TD_PREFETCH(p)       _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#    endif
+#    define TD_ASSUME_ALIGNED(p, n)  (p)
+#    define TD__UNUSED
+#else
+#    define TD_LIKELY(x)             (x)
+#    define TD_UNLIKELY(x)           (x)
+#    define TD_FORCE_INLINE          inline
+#    define TD_NOINLINE
+#    define TD_COLD
+#    define TD_RESTRICT
+#    define TD_PREFETCH(p)           ((void)(p))
+#    define TD_ASSUME_ALIGNED(p, n)  (p)
+#    define TD__UNUSED
+#endif
+
 #ifdef COMPILER_MS
 #  define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#if defined TDLIB_IMPLEMENTATION && !defined _POSIX_C_SOURCE && \
+    !defined _XOPEN_SOURCE && !defined _DEFAULT_SOURCE &&          \
+    !defined _GNU_SOURCE && !defined _BSD_SOURCE
+#    define _DEFAULT_SOURCE
+#endif
+
+#if defined COMPILER_MS
+#    define TD_THREAD_LOCAL __declspec(thread)
+#else
+#    define TD_THREAD_LOCAL __thread
+#endif
+
 #include <stdint.h>
 
 typedef int8_t  i8;
@@ -205,12 +964,189 @@ typedef double f64;
 #define local_persist   static
 #define internal        static
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef MALLOC
+typedef volatile u32   TD_Atomic_U32;
+typedef volatile u64   TD_Atomic_U64;
+typedef void *volatile TD_Atomic_Ptr;
+
+#if defined COMPILER_MS
+#include <intrin.h>
+
+#define TD_RELAXED 0
+#define TD_ACQUIRE 1
+#define TD_RELEASE 2
+#define TD_ACQ_REL 3
+#define TD_SEQ_CST 4
+
+/* x86 only reorders stores after loads, so anything short of seq_cst just
+   has to stop the compiler. ARM needs the real thing. */
+#if defined _M_ARM64 || defined _M_ARM
+#    define td__ms_fence(order)  ((order) != TD_RELAXED ? __dmb(0xB) : (void)0)
+#    define td_cpu_relax()       __yield()
+#else
+#    define td__ms_fence(order)                                         \
+         ((order) == TD_SEQ_CST ? _mm_mfence() :                        \
+          (order) != TD_RELAXED ? _ReadWriteBarrier() : (void)0)
+#    define td_cpu_relax()       _mm_pause()
+#endif
+
+#define td_atomic_fence(order) td__ms_fence(order)
+
+static __forceinline u32
+td__ms_load_u32(TD_Atomic_U32 *p, int order)
+{
+    u32 v = *p;
+    td__ms_fence(order == TD_SEQ_CST ? TD_ACQUIRE : order);
+    return v;
+}
+
+static __forceinline u64
+td__ms_load_u64(TD_Atomic_U64 *p, int order)
+{
+#if defined _WIN64
+    u64 v = *p;
+    td__ms_fence(order == TD_SEQ_CST ? TD_ACQUIRE : order);
+    return v;
+#else
+    (void)order;
+    return (u64)_InterlockedCompareExchange64((volatile __int64 *)p, 0, 0);
+#endif
+}
+
+static __forceinline void *
+td__ms_load_ptr(TD_Atomic_Ptr *p, int order)
+{
+    void *v = *p;
+    td__ms_fence(order == TD_SEQ_CST ? TD_ACQUIRE : order);
+    return v;
+}
+
+static __forceinline bool
+td__ms_cas_u32(TD_Atomic_U32 *p, u32 *expected, u32 desired)
+{
+    u32 old = (u32)_InterlockedCompareExchange((volatile long *)p,
+                                               (long)desired, (long)*expected);
+    if (old == *expected) return true;
+    *expected = old;
+    return false;
+}
+
+static __forceinline bool
+td__ms_cas_u64(TD_Atomic_U64 *p, u64 *expected, u64 desired)
+{
+    u64 old = (u64)_InterlockedCompareExchange64((volatile __int64 *)p,
+                                                 (__int64)desired,
+                                                 (__int64)*expected);
+    if (old == *expected) return true;
+    *expected = old;
+    return false;
+}
+
+static __forceinline bool
+td__ms_cas_ptr(TD_Atomic_Ptr *p, void **expected, void *desired)
+{
+    void *old = _InterlockedCompareExchangePointer((void *volatile *)p,
+                                                   desired, *expected);
+    if (old == *expected) return true;
+    *expected = old;
+    return false;
+}
+
+#define td_atomic_load_u32(p, order)     td__ms_load_u32((p), (order))
+#define td_atomic_load_u64(p, order)     td__ms_load_u64((p), (order))
+#define td_atomic_load_ptr(p, order)     td__ms_load_ptr((p), (order))
+
+#define td_atomic_store_u32(p, v, order)                                \
+    ((order) == TD_SEQ_CST || (order) == TD_ACQ_REL                     \
+     ? (void)_InterlockedExchange((volatile long *)(p), (long)(v))      \
+     : (td__ms_fence(order), (void)(*(p) = (v))))
+#define td_atomic_store_u64(p, v, order)                                \
+    ((void)(order), (void)_InterlockedExchange64((volatile __int64 *)(p), \
+                                                 (__int64)(v)))
+#define td_atomic_store_ptr(p, v, order)                                \
+    ((void)(order), (void)_InterlockedExchangePointer((void *volatile *)(p), (v)))
+
+#define td_atomic_exchange_u32(p, v, order)                             \
+    ((void)(order), (u32)_InterlockedExchange((volatile long *)(p), (long)(v)))
+#define td_atomic_exchange_u64(p, v, order)                             \
+    ((void)(order), (u64)_InterlockedExchange64((volatile __int64 *)(p), \
+                                                (__int64)(v)))
+#define td_atomic_exchange_ptr(p, v, order)                             \
+    ((void)(order), _InterlockedExchangePointer((void *volatile *)(p), (v)))
+
+#define td_atomic_cas_u32(p, e, d, order) ((void)(order), td__ms_cas_u32((p), (e), (d)))
+#define td_atomic_cas_u64(p, e, d, order) ((void)(order), td__ms_cas_u64((p), (e), (d)))
+#define td_atomic_cas_ptr(p, e, d, order) ((void)(order), td__ms_cas_ptr((p), (e), (d)))
+
+#define td_atomic_fetch_add_u32(p, v, order)                            \
+    ((void)(order), (u32)_InterlockedExchangeAdd((volatile long *)(p), (long)(v)))
+#define td_atomic_fetch_add_u64(p, v, order)                            \
+    ((void)(order), (u64)_InterlockedExchangeAdd64((volatile __int64 *)(p), \
+                                                   (__int64)(v)))
+
+#else
+
+#define TD_RELAXED __ATOMIC_RELAXED
+#define TD_ACQUIRE __ATOMIC_ACQUIRE
+#define TD_RELEASE __ATOMIC_RELEASE
+#define TD_ACQ_REL __ATOMIC_ACQ_REL
+#define TD_SEQ_CST __ATOMIC_SEQ_CST
+
+/* A failed cas is a load, and loads can't be release */
+#define td__cas_fail_order(order)                                       \
+    ((order) == TD_RELEASE ? TD_RELAXED :                               \
+     (order) == TD_ACQ_REL ? TD_ACQUIRE : (order))
+
+#define td__atomic_load(p, order)        __atomic_load_n((p), (order))
+#define td__atomic_store(p, v, order)    __atomic_store_n((p), (v), (order))
+#define td__atomic_exchange(p, v, order) __atomic_exchange_n((p), (v), (order))
+#define td__atomic_cas(p, e, d, order)                                  \
+    __atomic_compare_exchange_n((p), (e), (d), false, (order),          \
+                                td__cas_fail_order(order))
+
+#define td_atomic_load_u32(p, order)         td__atomic_load((p), (order))
+#define td_atomic_load_u64(p, order)         td__atomic_load((p), (order))
+#define td_atomic_load_ptr(p, order)         td__atomic_load((p), (order))
+#define td_atomic_store_u32(p, v, order)     td__atomic_store((p), (u32)(v), (order))
+#define td_atomic_store_u64(p, v, order)     td__atomic_store((p), (u64)(v), (order))
+#define td_atomic_store_ptr(p, v, order)     td__atomic_store((p), (void *)(v), (order))
+#define td_atomic_exchange_u32(p, v, order)  td__atomic_exchange((p), (u32)(v), (order))
+#define td_atomic_exchange_u64(p, v, order)  td__atomic_exchange((p), (u64)(v), (order))
+#define td_atomic_exchange_ptr(p, v, order)  td__atomic_exchange((p), (void *)(v), (order))
+#define td_atomic_cas_u32(p, e, d, order)    td__atomic_cas((p), (e), (u32)(d), (order))
+#define td_atomic_cas_u64(p, e, d, order)    td__atomic_cas((p), (e), (u64)(d), (order))
+#define td_atomic_cas_ptr(p, e, d, order)    td__atomic_cas((p), (e), (void *)(d), (order))
+#define td_atomic_fetch_add_u32(p, v, order) __atomic_fetch_add((p), (u32)(v), (order))
+#define td_atomic_fetch_add_u64(p, v, order) __atomic_fetch_add((p), (u64)(v), (order))
+
+#define td_atomic_fence(order) __atomic_thread_fence(order)
+
+#if defined __x86_64__ || defined __i386__
+#    define td_cpu_relax() __builtin_ia32_pause()
+#elif defined __aarch64__ || defined __arm__
+#    define td_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#    define td_cpu_relax() ((void)0)
+#endif
+
+#endif
+
+#if defined TDLIB_ALLOCSTATS && !defined TD_MALLOC && !defined TD_REALLOC && !defined TD_FREE
+#    define TD_MALLOC(sz)       td__stats_malloc((sz), __FILE__, __LINE__)
+#    define TD_REALLOC(ptr, sz) td__stats_realloc((ptr), (sz), __FILE__, __LINE__)
+#    define TD_FREE(p)          td__stats_free(p)
+#    define TD__ALLOCSTATS
+#    define TD__SITE            __FILE__, __LINE__
+#else
+#    define TD__SITE            NULL, 0
+#endif
+
+#ifndef TD_MALLOC
 #    define TD_MALLOC(sz) malloc(sz)
 #endif
 
@@ -226,6 +1162,75 @@ typedef double f64;
 #    define TD_VECINITSZ 1024
 #endif
 
+#ifndef TD_WRITERSZ
+#    define TD_WRITERSZ (64 * 1024)
+#endif
+
+#ifndef TD_FOLLOWPOLLMS
+#    define TD_FOLLOWPOLLMS 250
+#endif
+
+#ifndef TD_DIRECTSZ
+#    define TD_DIRECTSZ (1024 * 1024)
+#endif
+
+/* Must be a power of two */
+#ifndef TD_JOBDEQUESZ
+#    define TD_JOBDEQUESZ 4096
+#endif
+
+#ifndef TD_SPINCOUNT
+#    define TD_SPINCOUNT 100
+#endif
+
+#ifndef TD_SCRATCHSZ
+#    if UINTPTR_MAX > 0xFFFFFFFFu
+#        define TD_SCRATCHSZ ((size_t)1 << 32)
+#    else
+#        define TD_SCRATCHSZ ((size_t)64 << 20)
+#    endif
+#endif
+
+#ifndef TD_SLABSZ
+#    define TD_SLABSZ (64 * 1024)
+#endif
+
+#ifndef TD_SLABRESERVE
+#    if UINTPTR_MAX > 0xFFFFFFFFu
+#        define TD_SLABRESERVE ((size_t)4 << 30)
+#    else
+#        define TD_SLABRESERVE ((size_t)256 << 20)
+#    endif
+#endif
+
+#ifndef TD_SLABCACHE
+#    define TD_SLABCACHE 64
+#endif
+
+#ifndef TD_POOLCHUNKSZ
+#    define TD_POOLCHUNKSZ (64 * 1024)
+#endif
+
+#ifndef TD_HUGESZ
+#    define TD_HUGESZ (2 * 1024 * 1024)
+#endif
+
+#ifndef TD_HISTBITS
+#    define TD_HISTBITS 7
+#endif
+
+#ifndef TD_COUNTERSHARDS
+#    define TD_COUNTERSHARDS 16
+#endif
+
+#ifndef TD_BENCHSAMPLES
+#    define TD_BENCHSAMPLES 31
+#endif
+
+#ifndef TD_BENCHSAMPLENS
+#    define TD_BENCHSAMPLENS 10000000
+#endif
+
 #ifndef TD_PANIC
 #define TD_PANIC(msg)                                           \
     do {                                                        \
@@ -238,20 +1243,21 @@ typedef double f64;
 /* It is a resizing function which required the vector in its right structural
    format and the required capacity. If the capacity exceeds the pre-allocated
    size of the vector, we resize. This function is unsafe and provides no
-   guaranteed successful reallocation */
+   guaranteed successful reallocation. The resize itself is td__vec_grow, out
+   of line, so an append site only carries the compare. */
 #define td__vec_alloc(vector, capacity)                                 \
     do {                                                                \
-        if ((capacity) > (vector)->alloc) {                             \
-            if ((vector)->alloc == 0) (vector)->alloc = TD_VECINITSZ;   \
-            while ((capacity) > (vector)->alloc) (vector)->alloc *= 2;  \
-            (vector)->data = TD_REALLOC((vector)->data,                 \
-                                     (vector)->alloc * sizeof(*(vector)->data)); \
-            if ((vector)->data == NULL) {                               \
-                TD_PANIC("TD_REALLOC: out of memory");                  \
-            }                                                           \
+        if (TD_UNLIKELY((capacity) > (vector)->alloc)) {                \
+            (vector)->data = td__vec_grow((vector)->data,               \
+                                          &(vector)->alloc,             \
+                                          sizeof(*(vector)->data),      \
+                                          (capacity), TD__SITE);        \
         }                                                               \
     } while (0)
 
+#define td_vec_slack(vector)                                            \
+    (((vector)->alloc - (vector)->size) * sizeof(*(vector)->data))
+
 #define td_vec_append(vector, item)                     \
     do {                                                \
         td__vec_alloc((vector), (vector)->size + 1);    \
@@ -267,31 +1273,104 @@ typedef double f64;
         (vector)->size += (count);                              \
     } while (0)
 
-/* Not null-terminated by default behavior */
 typedef struct {
-    char   *data;
-    size_t  size, alloc;
-} TD_String;
+    TD_Atomic_U64 used;
+    u64           limit;
+} TD_Budget;
 
-typedef struct {
-    char   *data;
-    size_t  size;
-} TD_String_View;
+#define td_vec_try_reserve(vector, capacity, budget)                    \
+    (TD_LIKELY((capacity) <= (vector)->alloc) ||                        \
+     ((vector)->data = td__vec_try_grow((vector)->data,                 \
+                                        &(vector)->alloc,               \
+                                        sizeof(*(vector)->data),        \
+                                        (capacity), (budget),           \
+                                        TD__SITE),                      \
+      (capacity) <= (vector)->alloc))
 
-#define td_string_append_cstr(string, cstr)             \
-    do {                                                \
-        const char *str = cstr;                         \
-        size_t size = strlen(cstr);                     \
-        td_vec_append_bulk((string), str, size);        \
+#define td_vec_try_append(vector, item, budget)                         \
+    (td_vec_try_reserve((vector), (vector)->size + 1, (budget))         \
+     ? ((vector)->data[(vector)->size++] = (item), true) : false)
+
+#define td_vec_try_append_bulk(vector, items, count, budget)            \
+    (td_vec_try_reserve((vector), (vector)->size + (count), (budget))   \
+     ? (memcpy((vector)->data + (vector)->size, (items),                \
+               (count)*sizeof(*(vector)->data)),                        \
+        (vector)->size += (count), true)                                \
+     : false)
+
+#define td_vec_release(vector, budget)                                  \
+    do {                                                                \
+        if ((budget) != NULL)                                           \
+            td_budget_release((budget),                                 \
+                              (vector)->alloc * sizeof(*(vector)->data)); \
+        TD_FREE((vector)->data);                                        \
+        (vector)->data = NULL;                                          \
+        (vector)->size = (vector)->alloc = 0;                           \
     } while (0)
 
-#define td_string_clear(string)                 \
-    do {                                        \
+/* In the header with td__vec_try_grow, so the try macros link without the
+   implementation just like the plain ones. */
+static TD_FORCE_INLINE bool
+td_budget_charge(TD_Budget *budget, size_t bytes)
+{
+    u64 used = td_atomic_load_u64(&budget->used, TD_RELAXED);
+
+    do {
+        if (bytes > budget->limit - used || used > budget->limit)
+            return false;
+    } while (!td_atomic_cas_u64(&budget->used, &used, used + bytes, TD_RELAXED));
+
+    return true;
+}
+
+static TD_FORCE_INLINE void
+td_budget_release(TD_Budget *budget, size_t bytes)
+{
+    td_atomic_fetch_add_u64(&budget->used, -(u64)bytes, TD_RELAXED);
+}
+
+/* Not null-terminated by default behavior */
+typedef struct {
+    char   *data;
+    size_t  size, alloc;
+} TD_String;
+
+typedef struct {
+    char   *data;
+    size_t  size;
+} TD_String_View;
+
+#define td_string_append_cstr(string, cstr)                     \
+    do {                                                        \
+        const char *td__cstr = (cstr);                          \
+        size_t td__len = strlen(td__cstr);                      \
+        td_vec_append_bulk((string), td__cstr, td__len);        \
+    } while (0)
+
+#define td_string_clear(string)                 \
+    do {                                        \
         TD_FREE((string)->data);                \
         (string)->data = NULL;                  \
         (string)->size = (string)->alloc = 0;   \
     } while (0)
 
+#define td_string_reset(string)                 \
+    do {                                        \
+        (string)->size = 0;                     \
+    } while (0)
+
+/* free holds one list per power of two, linked through the buffers
+   themselves. retained is the sum of their capacities. */
+typedef struct {
+    void   *free[sizeof(size_t) * 8];
+    size_t  retained, limit;
+} TD_String_Pool;
+
+TD_LIBDEF void      td_string_pool_init(TD_String_Pool*, size_t);
+TD_LIBDEF TD_String td_string_pool_get(TD_String_Pool*, size_t);
+TD_LIBDEF void      td_string_pool_put(TD_String_Pool*, TD_String*);
+TD_LIBDEF void      td_string_pool_release(TD_String_Pool*);
+
 TD_LIBDEF TD_String_View td_string_view_from_string(TD_String*);
 TD_LIBDEF TD_String_View td_string_view_from_cstr(char*);
 TD_LIBDEF bool           td_string_view_equal(TD_String_View, TD_String_View);
@@ -304,12 +1383,762 @@ TD_LIBDEF TD_String_View td_string_view_trim(TD_String_View);
 TD_LIBDEF TD_String_View td_string_slice(const TD_String*, size_t, size_t);
 
 TD_LIBDEF bool		 td_read_file_to_string(TD_String*, FILE*);
+
+enum {
+    TD_HINT_SEQUENTIAL = 1 << 0,
+    TD_HINT_WILLNEED   = 1 << 1,
+    TD_HINT_DONTNEED   = 1 << 2,
+    TD_HINT_DIRECT     = 1 << 3,
+};
+
+TD_LIBDEF void td_file_advise(int, u32);
+TD_LIBDEF bool td_read_file_to_string_ex(TD_String*, FILE*, u32);
+TD_LIBDEF bool td_read_path_to_string(TD_String*, const char*, u32);
+TD_LIBDEF bool td_try_read_file_to_string(TD_String*, FILE*, TD_Budget*);
+
+/* Either fd or fp is the target. The other one is -1 or NULL. data is
+   allocated on the first write and has a fixed capacity of alloc bytes. */
+typedef struct {
+    char   *data;
+    size_t  size, alloc;
+    int     fd;
+    FILE   *fp;
+    bool    failed;
+} TD_Writer;
+
+#define td_writer_write_cstr(writer, cstr)                              \
+    td_writer_write((writer), (cstr), strlen(cstr))
+
+TD_LIBDEF void td_writer_init_fd(TD_Writer*, int);
+TD_LIBDEF void td_writer_init_file(TD_Writer*, FILE*);
+TD_LIBDEF bool td_writer_write(TD_Writer*, const void*, size_t);
+TD_LIBDEF bool td_writer_write_view(TD_Writer*, TD_String_View);
+TD_LIBDEF bool td_writer_write_string(TD_Writer*, const TD_String*);
+TD_LIBDEF bool td_writer_write_views(TD_Writer*, const TD_String_View*, size_t);
+TD_LIBDEF bool td_writer_flush(TD_Writer*);
+TD_LIBDEF bool td_writer_close(TD_Writer*);
+
+TD_LIBDEF i64  td_copy_fd(int, int, i64);
+TD_LIBDEF bool td_copy_file(const char*, const char*);
+
+/* inotify_fd and watch are -1 when we are polling. device and inode identify
+   the file behind fd so that rotation can be noticed. */
+typedef struct {
+    char *path;
+    int   fd;
+    u64   offset;
+    u64   device, inode;
+    int   inotify_fd, watch;
+} TD_Follower;
+
+typedef struct {
+    void   *base;
+    size_t  size;
+} TD_Mapping;
+
+#define td_vec_save(vector, path, version)                              \
+    td__vec_save((path), (version), (vector)->data,                     \
+                 sizeof(*(vector)->data), (vector)->size)
+
+/* td__vec_load sets size to (size_t)-1 when it fails. */
+#define td_vec_load(vector, path, version)                              \
+    ((vector)->data = td__vec_load((path), (version),                   \
+                                   sizeof(*(vector)->data),             \
+                                   (vector)->data, &(vector)->size,     \
+                                   &(vector)->alloc),                   \
+     (vector)->size != (size_t)-1 || ((vector)->size = 0, false))
+
+/* A buffer the vector owned is freed first. alloc 0 marks the mapped one
+   as not the vector's own. */
+#define td_vec_map(vector, path, version, mapping)                      \
+    ((vector)->alloc != 0 ? (void)TD_FREE((vector)->data) : (void)0,    \
+     (vector)->data = td__vec_map((path), (version),                    \
+                                  sizeof(*(vector)->data), (mapping),   \
+                                  &(vector)->size),                     \
+     (vector)->alloc = 0, (vector)->data != NULL)
+
+TD_LIBDEF bool  td__vec_save(const char*, u32, const void*, size_t, size_t);
+TD_LIBDEF void *td__vec_load(const char*, u32, size_t, void*, size_t*, size_t*);
+TD_LIBDEF void *td__vec_map(const char*, u32, size_t, TD_Mapping*, size_t*);
+TD_LIBDEF void  td_unmap(TD_Mapping*);
+
+TD_LIBDEF bool td_follower_open(TD_Follower*, const char*);
+TD_LIBDEF i64  td_follower_read(TD_Follower*, TD_String*);
+TD_LIBDEF i64  td_follower_wait(TD_Follower*, TD_String*, i32);
+TD_LIBDEF void td_follower_close(TD_Follower*);
+
+typedef void TD_Job_Fn(void*);
+typedef void TD_Range_Fn(size_t, size_t, void*);
+
+typedef struct {
+    TD_Atomic_U64 pending;
+} TD_Job_Group;
+
+typedef struct {
+    TD_Job_Fn    *fn;
+    void         *arg;
+    TD_Job_Group *group;
+} TD_Job;
+
+typedef struct TD_Job_Pool TD_Job_Pool;
+
+TD_LIBDEF TD_Job_Pool *td_job_pool_create(u32);
+TD_LIBDEF void         td_job_pool_destroy(TD_Job_Pool*);
+TD_LIBDEF u32          td_job_pool_size(const TD_Job_Pool*);
+TD_LIBDEF void         td_job_submit(TD_Job_Pool*, TD_Job_Group*, TD_Job_Fn*, void*);
+TD_LIBDEF void         td_job_wait(TD_Job_Pool*, TD_Job_Group*);
+TD_LIBDEF void         td_parallel_for(TD_Job_Pool*, size_t, size_t, size_t,
+                                       TD_Range_Fn*, void*);
+
+#define TD_CACHELINE 64
+
+/* Padded in front so that whatever precedes it in the queue struct stays
+   off its line. */
+typedef struct {
+    char          pad[TD_CACHELINE - 2 * sizeof(u64)];
+    TD_Atomic_U64 value;
+    u64           cached;
+} TD_Ring_Index;
+
+#define td__ring_alloc(queue, capacity)                                 \
+    do {                                                                \
+        size_t td__cap = 1;                                             \
+        while (td__cap < (size_t)(capacity)) td__cap *= 2;              \
+        (queue)->data = TD_MALLOC(td__cap * sizeof(*(queue)->data));    \
+        if ((queue)->data == NULL) {                                    \
+            TD_PANIC("TD_MALLOC: out of memory");                       \
+        }                                                               \
+        (queue)->alloc = td__cap;                                       \
+        (queue)->head = (queue)->tail = (TD_Ring_Index){ .value = 0 };  \
+    } while (0)
+
+#define td_spsc_init(queue, capacity) td__ring_alloc((queue), (capacity))
+
+#define td_spsc_free(queue)                     \
+    do {                                        \
+        TD_FREE((queue)->data);                 \
+        (queue)->data = NULL;                   \
+        (queue)->alloc = 0;                     \
+    } while (0)
+
+/* tail.cached is the producer's last look at head, head.cached is the
+   consumer's last look at tail. */
+#define td_spsc_push(queue, item, ok)                                   \
+    do {                                                                \
+        u64 td__t = td_atomic_load_u64(&(queue)->tail.value, TD_RELAXED); \
+        if (td__t - (queue)->tail.cached == (queue)->alloc)             \
+            (queue)->tail.cached =                                      \
+                td_atomic_load_u64(&(queue)->head.value, TD_ACQUIRE);   \
+        if (td__t - (queue)->tail.cached == (queue)->alloc) {           \
+            (ok) = false;                                               \
+        } else {                                                        \
+            (queue)->data[td__t & ((queue)->alloc - 1)] = (item);       \
+            td_atomic_store_u64(&(queue)->tail.value, td__t + 1, TD_RELEASE); \
+            (ok) = true;                                                \
+        }                                                               \
+    } while (0)
+
+#define td_spsc_pop(queue, out, ok)                                     \
+    do {                                                                \
+        u64 td__h = td_atomic_load_u64(&(queue)->head.value, TD_RELAXED); \
+        if (td__h == (queue)->head.cached)                              \
+            (queue)->head.cached =                                      \
+                td_atomic_load_u64(&(queue)->tail.value, TD_ACQUIRE);   \
+        if (td__h == (queue)->head.cached) {                            \
+            (ok) = false;                                               \
+        } else {                                                        \
+            (out) = (queue)->data[td__h & ((queue)->alloc - 1)];        \
+            td_atomic_store_u64(&(queue)->head.value, td__h + 1, TD_RELEASE); \
+            (ok) = true;                                                \
+        }                                                               \
+    } while (0)
+
+#define td_spsc_push_bulk(queue, items, count, done)                    \
+    do {                                                                \
+        u64 td__t = td_atomic_load_u64(&(queue)->tail.value, TD_RELAXED); \
+        u64 td__n = (count);                                            \
+        if ((queue)->alloc - (td__t - (queue)->tail.cached) < td__n)    \
+            (queue)->tail.cached =                                      \
+                td_atomic_load_u64(&(queue)->head.value, TD_ACQUIRE);   \
+        if ((queue)->alloc - (td__t - (queue)->tail.cached) < td__n)    \
+            td__n = (queue)->alloc - (td__t - (queue)->tail.cached);    \
+        for (u64 td__i = 0; td__i < td__n; td__i++)                     \
+            (queue)->data[(td__t + td__i) & ((queue)->alloc - 1)] =     \
+                (items)[td__i];                                         \
+        if (td__n > 0)                                                  \
+            td_atomic_store_u64(&(queue)->tail.value, td__t + td__n, TD_RELEASE); \
+        (done) = td__n;                                                 \
+    } while (0)
+
+#define td_spsc_pop_bulk(queue, items, count, done)                     \
+    do {                                                                \
+        u64 td__h = td_atomic_load_u64(&(queue)->head.value, TD_RELAXED); \
+        u64 td__n = (count);                                            \
+        if ((queue)->head.cached - td__h < td__n)                       \
+            (queue)->head.cached =                                      \
+                td_atomic_load_u64(&(queue)->tail.value, TD_ACQUIRE);   \
+        if ((queue)->head.cached - td__h < td__n)                       \
+            td__n = (queue)->head.cached - td__h;                       \
+        for (u64 td__i = 0; td__i < td__n; td__i++)                     \
+            (items)[td__i] =                                            \
+                (queue)->data[(td__h + td__i) & ((queue)->alloc - 1)];  \
+        if (td__n > 0)                                                  \
+            td_atomic_store_u64(&(queue)->head.value, td__h + td__n, TD_RELEASE); \
+        (done) = td__n;                                                 \
+    } while (0)
+
+#define td_mpmc_init(queue, capacity)                                   \
+    do {                                                                \
+        td__ring_alloc((queue), (capacity));                            \
+        for (size_t td__i = 0; td__i < (queue)->alloc; td__i++)         \
+            (queue)->data[td__i].seq = td__i;                           \
+    } while (0)
+
+#define td_mpmc_free(queue) td_spsc_free(queue)
+
+/* A cell is free for position pos when its seq is pos, and full when it is
+   pos + 1. Whoever wins the cas on the index owns the cell until it bumps
+   seq again. */
+#define td_mpmc_push(queue, element, ok)                                   \
+    do {                                                                \
+        u64 td__pos = td_atomic_load_u64(&(queue)->tail.value, TD_RELAXED); \
+        (ok) = false;                                                   \
+        for (;;) {                                                      \
+            u64 td__seq = td_atomic_load_u64(                           \
+                &(queue)->data[td__pos & ((queue)->alloc - 1)].seq, TD_ACQUIRE); \
+            i64 td__diff = (i64)(td__seq - td__pos);                    \
+            if (td__diff == 0) {                                        \
+                if (td_atomic_cas_u64(&(queue)->tail.value, &td__pos,   \
+                                      td__pos + 1, TD_RELAXED)) {       \
+                    (ok) = true;                                        \
+                    break;                                              \
+                }                                                       \
+            } else if (td__diff < 0) {                                  \
+                break;                                                  \
+            } else {                                                    \
+                td__pos = td_atomic_load_u64(&(queue)->tail.value, TD_RELAXED); \
+            }                                                           \
+        }                                                               \
+        if (ok) {                                                       \
+            (queue)->data[td__pos & ((queue)->alloc - 1)].item = (element); \
+            td_atomic_store_u64(&(queue)->data[td__pos & ((queue)->alloc - 1)].seq, \
+                                td__pos + 1, TD_RELEASE);               \
+        }                                                               \
+    } while (0)
+
+#define td_mpmc_pop(queue, out, ok)                                     \
+    do {                                                                \
+        u64 td__pos = td_atomic_load_u64(&(queue)->head.value, TD_RELAXED); \
+        (ok) = false;                                                   \
+        for (;;) {                                                      \
+            u64 td__seq = td_atomic_load_u64(                           \
+                &(queue)->data[td__pos & ((queue)->alloc - 1)].seq, TD_ACQUIRE); \
+            i64 td__diff = (i64)(td__seq - (td__pos + 1));              \
+            if (td__diff == 0) {                                        \
+                if (td_atomic_cas_u64(&(queue)->head.value, &td__pos,   \
+                                      td__pos + 1, TD_RELAXED)) {       \
+                    (ok) = true;                                        \
+                    break;                                              \
+                }                                                       \
+            } else if (td__diff < 0) {                                  \
+                break;                                                  \
+            } else {                                                    \
+                td__pos = td_atomic_load_u64(&(queue)->head.value, TD_RELAXED); \
+            }                                                           \
+        }                                                               \
+        if (ok) {                                                       \
+            (out) = (queue)->data[td__pos & ((queue)->alloc - 1)].item; \
+            td_atomic_store_u64(&(queue)->data[td__pos & ((queue)->alloc - 1)].seq, \
+                                td__pos + (queue)->alloc, TD_RELEASE);  \
+        }                                                               \
+    } while (0)
+
+#define td_mpmc_push_bulk(queue, items, count, done)                    \
+    do {                                                                \
+        bool td__ok = true;                                             \
+        (done) = 0;                                                     \
+        while ((done) < (count)) {                                      \
+            td_mpmc_push((queue), (items)[(done)], td__ok);             \
+            if (!td__ok) break;                                         \
+            (done)++;                                                   \
+        }                                                               \
+    } while (0)
+
+#define td_mpmc_pop_bulk(queue, items, count, done)                     \
+    do {                                                                \
+        bool td__ok = true;                                             \
+        (done) = 0;                                                     \
+        while ((done) < (count)) {                                      \
+            td_mpmc_pop((queue), (items)[(done)], td__ok);              \
+            if (!td__ok) break;                                         \
+            (done)++;                                                   \
+        }                                                               \
+    } while (0)
+
+typedef struct {
+    TD_Atomic_U32 state;    /* 0 unlocked, 1 locked, 2 locked with sleepers */
+} TD_Mutex;
+
+typedef struct {
+    TD_Atomic_U32 state;
+    bool          auto_reset;
+} TD_Event;
+
+typedef struct {
+    TD_Atomic_U32 count, waiters;
+} TD_Semaphore;
+
+typedef struct {
+    TD_Atomic_U32 state;    /* reader count, writer bit and sleeper bit */
+} TD_RWLock;
+
+TD_LIBDEF void td_mutex_lock(TD_Mutex*);
+TD_LIBDEF bool td_mutex_trylock(TD_Mutex*);
+TD_LIBDEF void td_mutex_unlock(TD_Mutex*);
+
+TD_LIBDEF void td_event_set(TD_Event*);
+TD_LIBDEF void td_event_reset(TD_Event*);
+TD_LIBDEF void td_event_wait(TD_Event*);
+
+TD_LIBDEF void td_semaphore_post(TD_Semaphore*, u32);
+TD_LIBDEF void td_semaphore_wait(TD_Semaphore*);
+TD_LIBDEF bool td_semaphore_trywait(TD_Semaphore*);
+
+TD_LIBDEF void td_rwlock_read_lock(TD_RWLock*);
+TD_LIBDEF void td_rwlock_read_unlock(TD_RWLock*);
+TD_LIBDEF void td_rwlock_write_lock(TD_RWLock*);
+TD_LIBDEF void td_rwlock_write_unlock(TD_RWLock*);
+
+/* size is how much is in use, alloc how much is reserved. committed is how
+   much of the reservation is accessible. */
+typedef struct {
+    u8     *data;
+    size_t  size, alloc;
+    size_t  committed;
+} TD_Arena;
+
+typedef struct {
+    TD_Arena *arena;
+    size_t    pos;
+} TD_Scratch;
+
+#define td__vec_alloc_arena(arena, vector, capacity)                    \
+    do {                                                                \
+        if ((capacity) > (vector)->alloc) {                             \
+            size_t td__old = (vector)->alloc;                           \
+            if ((vector)->alloc == 0) (vector)->alloc = TD_VECINITSZ;   \
+            while ((capacity) > (vector)->alloc) (vector)->alloc *= 2;  \
+            (vector)->data = td__arena_grow((arena), (vector)->data,    \
+                                 td__old * sizeof(*(vector)->data),     \
+                                 (vector)->alloc * sizeof(*(vector)->data)); \
+        }                                                               \
+    } while (0)
+
+#define td_vec_append_arena(arena, vector, item)                        \
+    do {                                                                \
+        td__vec_alloc_arena((arena), (vector), (vector)->size + 1);     \
+        (vector)->data[(vector)->size++] = (item);                      \
+    } while (0)
+
+#define td_vec_append_bulk_arena(arena, vector, items, count)           \
+    do {                                                                \
+        td__vec_alloc_arena((arena), (vector), (vector)->size + (count)); \
+        memcpy((vector)->data + (vector)->size,                         \
+               (items),                                                 \
+               (count)*sizeof(*(vector)->data));                        \
+        (vector)->size += (count);                                      \
+    } while (0)
+
+TD_LIBDEF bool       td_arena_init(TD_Arena*, size_t);
+TD_LIBDEF void       td_arena_free(TD_Arena*);
+TD_LIBDEF void      *td_arena_push(TD_Arena*, size_t);
+TD_LIBDEF void       td_arena_reset(TD_Arena*, size_t);
+TD_LIBDEF void      *td__arena_grow(TD_Arena*, void*, size_t, size_t);
+
+TD_LIBDEF TD_Scratch td_scratch_begin(TD_Arena**, size_t);
+TD_LIBDEF void       td_scratch_end(TD_Scratch);
+TD_LIBDEF void       td_scratch_thread_release(void);
+
+/* chunk is the one being carved. size and alloc are bytes used and
+   available in it. chunks links every chunk through its first word. */
+typedef struct {
+    void   *free;
+    u8     *chunk;
+    size_t  size, alloc;
+    size_t  object_size;
+    void   *chunks;
+} TD_Pool;
+
+TD_LIBDEF void  td_pool_init(TD_Pool*, size_t);
+TD_LIBDEF void *td_pool_get(TD_Pool*);
+TD_LIBDEF void  td_pool_put(TD_Pool*, void*);
+TD_LIBDEF void  td_pool_release(TD_Pool*);
+
+TD_LIBDEF void *td_slab_alloc(size_t);
+TD_LIBDEF void *td_slab_realloc(void*, size_t);
+TD_LIBDEF void  td_slab_free(void*);
+TD_LIBDEF void  td_slab_thread_flush(void);
+
+TD_LIBDEF void *td__stats_malloc(size_t, const char*, int);
+TD_LIBDEF void *td__stats_realloc(void*, size_t, const char*, int);
+TD_LIBDEF void  td__stats_free(void*);
+TD_LIBDEF void  td__stats_slack(size_t, const char*, int);
+TD_LIBDEF void  td_alloc_stats_text(FILE*);
+TD_LIBDEF void  td_alloc_stats_json(FILE*);
+
+enum {
+    TD_HUGE_OFF,
+    TD_HUGE_THP,
+    TD_HUGE_TLB,
+};
+
+TD_LIBDEF void *td_aligned_alloc(size_t, size_t);
+TD_LIBDEF void *td_aligned_realloc(void*, size_t, size_t);
+TD_LIBDEF void  td_aligned_free(void*);
+TD_LIBDEF void  td_huge_pages(u32);
+
+/* Every shard gets a cache line to itself. The padding goes after value so
+   that two shards' values are never on the same line, whatever the
+   alignment of the struct. */
+typedef struct TD_Counter {
+    struct {
+        TD_Atomic_U64 value;
+        u8            pad[TD_CACHELINE - sizeof(u64)];
+    } shards[TD_COUNTERSHARDS];
+    const char        *name;
+    struct TD_Counter *next;
+    bool               gauge;
+} TD_Counter;
+
+typedef TD_Counter TD_Gauge;
+
+/* 1 + the shard this thread adds to, 0 until it picked one */
+TD__VARDECL TD_THREAD_LOCAL u32 td__counter_slot;
+
+TD_LIBDEF u32  td__counter_assign(void);
+TD_LIBDEF u64  td_counter_read(const TD_Counter*);
+TD_LIBDEF i64  td_gauge_read(const TD_Gauge*);
+TD_LIBDEF void td_counter_register(TD_Counter*, const char*);
+TD_LIBDEF void td_gauge_register(TD_Gauge*, const char*);
+TD_LIBDEF void td_metrics_dump(FILE*);
+
+TD__VARDECL TD_Counter td_metric_vec_grows;
+TD__VARDECL TD_Counter td_metric_vec_grow_bytes;
+TD__VARDECL TD_Counter td_metric_bytes_read;
+TD__VARDECL TD_Counter td_metric_bytes_written;
+
+static TD_FORCE_INLINE void
+td_counter_add(TD_Counter *c, u64 n)
+{
+    u32 slot = td__counter_slot;
+    if (TD_UNLIKELY(slot == 0)) slot = td__counter_assign();
+    td_atomic_fetch_add_u64(&c->shards[slot - 1].value, n, TD_RELAXED);
+}
+
+static TD_FORCE_INLINE void
+td_gauge_add(TD_Gauge *g, i64 delta)
+{
+    td_counter_add(g, (u64)delta);
+}
+
+/* The library's own counting. Off, it references nothing, so a file that
+   only uses the vector macros links without the implementation. */
+#if defined TDLIB_METRICS
+#    define td__metric_add(c, n) td_counter_add((c), (n))
+#else
+#    define td__metric_add(c, n) ((void)0)
+#endif
+
+/* Compiled into every file that includes the header, so it uses that file's
+   TD_REALLOC like the rest of the vector macros do. With stats on, the
+   call site is passed through so the books still name the append. */
+static TD__UNUSED TD_COLD TD_NOINLINE void *
+td__vec_grow(void *data, size_t *alloc, size_t elem_size, size_t capacity,
+             const char *file, int line)
+{
+    size_t cap = *alloc == 0 ? TD_VECINITSZ : *alloc;
+    while (capacity > cap) cap *= 2;
+
+    if (TD_UNLIKELY(data != NULL && *alloc == 0)) {
+        TD_PANIC("td_vec: can't grow a buffer the vector doesn't own");
+    }
+
+#if defined TD__ALLOCSTATS
+    td__stats_slack((cap - capacity) * elem_size, file, line);
+    data = td__stats_realloc(data, cap * elem_size, file, line);
+#else
+    (void)file;
+    (void)line;
+    data = TD_REALLOC(data, cap * elem_size);
+#endif
+    if (data == NULL) {
+        TD_PANIC("TD_REALLOC: out of memory");
+    }
+
+    td__metric_add(&td_metric_vec_grows, 1);
+    td__metric_add(&td_metric_vec_grow_bytes, (cap - *alloc) * elem_size);
+    *alloc = cap;
+    return data;
+}
+
+/* The slow half of td_vec_try_reserve, kept next to td__vec_grow for the
+   same reasons. Same growth policy, but every way it can go wrong is
+   reported instead of fatal. Returns the new buffer, or data and alloc
+   untouched with errno set. */
+static TD__UNUSED TD_COLD TD_NOINLINE void *
+td__vec_try_grow(void *data, size_t *alloc, size_t elem_size, size_t capacity,
+                 TD_Budget *budget, const char *file, int line)
+{
+    size_t cap = *alloc == 0 ? TD_VECINITSZ : *alloc;
+    size_t limit = elem_size ? (size_t)-1 / elem_size : (size_t)-1;
+    void *p;
+
+    if (data != NULL && *alloc == 0) {
+        errno = EINVAL;
+        return data;
+    }
+    while (capacity > cap) {
+        if (cap > limit / 2) {
+            errno = ENOMEM;
+            return data;
+        }
+        cap *= 2;
+    }
+    if (cap > limit) {
+        errno = ENOMEM;
+        return data;
+    }
+
+    if (budget != NULL && !td_budget_charge(budget, (cap - *alloc) * elem_size)) {
+        errno = ENOBUFS;
+        return data;
+    }
+
+#if defined TD__ALLOCSTATS
+    p = td__stats_realloc(data, cap * elem_size, file, line);
+#else
+    (void)file;
+    (void)line;
+    p = TD_REALLOC(data, cap * elem_size);
+#endif
+    if (p == NULL) {
+        if (budget != NULL) td_budget_release(budget, (cap - *alloc) * elem_size);
+        errno = ENOMEM;
+        return data;
+    }
+#if defined TD__ALLOCSTATS
+    td__stats_slack((cap - capacity) * elem_size, file, line);
+#endif
+
+    td__metric_add(&td_metric_vec_grows, 1);
+    td__metric_add(&td_metric_vec_grow_bytes, (cap - *alloc) * elem_size);
+    *alloc = cap;
+    return p;
+}
+
+enum {
+    TD_CPU_SSE2     = 1u << 0,
+    TD_CPU_SSE42    = 1u << 1,
+    TD_CPU_POPCNT   = 1u << 2,
+    TD_CPU_AVX2     = 1u << 3,
+    TD_CPU_BMI2     = 1u << 4,
+    TD_CPU_AVX512F  = 1u << 5,
+    TD_CPU_AVX512BW = 1u << 6,
+    TD_CPU_NEON     = 1u << 7,
+};
+
+#define td_cpu_has(features) ((td_cpu_features() & (features)) == (features))
+
+TD_LIBDEF u32    td_cpu_features(void);
+TD_LIBDEF size_t td_string_view_count(TD_String_View, char);
+
+typedef struct {
+    u64  start, elapsed;
+    bool running;
+} TD_Stopwatch;
+
+TD_LIBDEF u64  td_time_now_ns(void);
+TD_LIBDEF u64  td_cycles_hz(void);
+TD_LIBDEF u64  td_cycles_to_ns(u64);
+TD_LIBDEF void td_stopwatch_start(TD_Stopwatch*);
+TD_LIBDEF void td_stopwatch_stop(TD_Stopwatch*);
+TD_LIBDEF void td_stopwatch_reset(TD_Stopwatch*);
+TD_LIBDEF u64  td_stopwatch_ns(const TD_Stopwatch*);
+
+/* Per iteration times in ns. bytes is what one iteration touches, 0 if it
+   means nothing; bytes_per_sec is then 0 too. The counters are per iteration
+   over all samples, -1 when that one couldn't be read, and only filled in
+   when counted is true. */
+typedef struct {
+    const char *name;
+    u64         bytes, iters;
+    u32         samples;
+    f64         min, median, p90, p99, max;
+    f64         bytes_per_sec;
+    bool        counted;
+    f64         cycles, instructions, branch_misses, l1d_misses, llc_misses;
+} TD_Bench_Result;
+
+typedef void TD_Bench_Fn(void*, u64);
+
+#if defined COMPILER_GNU || defined COMPILER_CLANG
+#    define td_do_not_optimize(p) __asm__ volatile ("" : : "g"(p) : "memory")
+#    define td_clobber()          __asm__ volatile ("" : : : "memory")
+#else
+TD__VARDECL void *volatile td__bench_sink;
+#    define td_do_not_optimize(p) (td__bench_sink = (void *)(p), _ReadWriteBarrier())
+#    define td_clobber()          _ReadWriteBarrier()
+#endif
+
+TD_LIBDEF TD_Bench_Result td_bench_run(const char*, TD_Bench_Fn*, void*, u64);
+TD_LIBDEF void            td_bench_print(FILE*, const TD_Bench_Result*);
+TD_LIBDEF void            td_bench_print_json(FILE*, const TD_Bench_Result*);
+TD_LIBDEF void            td_bench_counters(bool);
+
+#if defined TDLIB_PROFILE
+#    define td_zone_begin(name) td__zone_begin(name)
+#    define td_zone_end()       td__zone_end()
+#    define td_zone(name)                                               \
+         for (int td__zone_once = (td__zone_begin(name), 1); td__zone_once; \
+              td__zone_once = (td__zone_end(), 0))
+#else
+#    define td_zone_begin(name) ((void)0)
+#    define td_zone_end()       ((void)0)
+#    define td_zone(name)
+#endif
+
+/* Bucket i < 2^TD_HISTBITS holds the value i. Above that, values with their
+   top bit at TD_HISTBITS + k go to the block of 2^TD_HISTBITS buckets
+   starting at (k + 1) << TD_HISTBITS. */
+#define TD__HIST_BUCKETS ((65 - TD_HISTBITS) << TD_HISTBITS)
+
+/* sum is only there for the mean and wraps if the values add up past
+   2^64; nanosecond latencies won't */
+typedef struct {
+    u64 total, min, max, sum;
+    u64 counts[TD__HIST_BUCKETS];
+} TD_Histogram;
+
+TD_LIBDEF void td_histogram_init(TD_Histogram*);
+TD_LIBDEF void td_histogram_record(TD_Histogram*, u64);
+TD_LIBDEF void td_histogram_record_n(TD_Histogram*, u64, u64);
+TD_LIBDEF void td_histogram_merge(TD_Histogram*, const TD_Histogram*);
+TD_LIBDEF u64  td_histogram_percentile(const TD_Histogram*, f64);
+TD_LIBDEF f64  td_histogram_mean(const TD_Histogram*);
+TD_LIBDEF void td_histogram_print(FILE*, const TD_Histogram*);
+TD_LIBDEF void td_histogram_print_json(FILE*, const TD_Histogram*);
+
+TD_LIBDEF bool td_string_view_parse_i64(TD_String_View*, i64*);
+TD_LIBDEF bool td_string_view_parse_u64(TD_String_View*, u64*);
+TD_LIBDEF bool td_string_view_parse_i32(TD_String_View*, i32*);
+TD_LIBDEF bool td_string_view_parse_u32(TD_String_View*, u32*);
+TD_LIBDEF bool td_string_view_parse_f64(TD_String_View*, f64*);
+TD_LIBDEF bool td_string_view_parse_f32(TD_String_View*, f32*);
+
+TD_LIBDEF void td__zone_begin(const char*);
+TD_LIBDEF void td__zone_end(void);
+TD_LIBDEF void td_profile_dump(FILE*);
+TD_LIBDEF void td_profile_reset(void);
+
+#if defined COMPILER_MS && defined ARCH_ARM64
+#    ifndef ARM64_CNTVCT
+#        define ARM64_CNTVCT ARM64_SYSREG(3, 3, 14, 0, 2)
+#    endif
+#    ifndef ARM64_CNTFRQ
+#        define ARM64_CNTFRQ ARM64_SYSREG(3, 3, 14, 0, 0)
+#    endif
+#endif
+
+static TD_FORCE_INLINE u64
+td_cycles(void)
+{
+#if defined COMPILER_MS && (defined ARCH_X64 || defined ARCH_X86)
+    return __rdtsc();
+#elif defined COMPILER_MS && defined ARCH_ARM64
+    return (u64)_ReadStatusReg(ARM64_CNTVCT);
+#elif (defined ARCH_X64 || defined ARCH_X86)
+    u32 lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+#elif defined ARCH_ARM64
+    u64 v;
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return td_time_now_ns();
+#endif
+}
 #endif /* TDLIB_H */
 
 
 #ifdef TDLIB_IMPLEMENTATION
 
 #include <ctype.h>
+#include <float.h>
+#include <locale.h>
+#include <time.h>
+
+#if defined PLATFORM_POSIX
+#    include <fcntl.h>
+#    include <limits.h>
+#    include <sys/stat.h>
+#    include <sys/uio.h>
+#    include <unistd.h>
+#elif defined PLATFORM_WIN
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    include <fcntl.h>
+#    include <io.h>
+#    include <sys/stat.h>
+#endif
+
+/* Linux specific calls go through syscall() so that none of this depends on
+   _GNU_SOURCE. syscall() and madvise() are declared only with the default
+   (misc) feature set, which glibc reports as __USE_MISC and musl as
+   _BSD_SOURCE. A file that asked for plain _POSIX_C_SOURCE doesn't get them,
+   and those paths are left out. */
+#if defined PLATFORM_POSIX
+#    include <poll.h>
+#    include <pthread.h>
+#    include <sched.h>
+#    include <sys/mman.h>
+#endif
+
+#if defined PLATFORM_LINUX
+#    include <sys/inotify.h>
+#    include <sys/sendfile.h>
+#    include <sys/syscall.h>
+#    if defined __GLIBC__
+#        if defined __USE_MISC
+#            define TD__HAVE_SYSCALL
+#        endif
+#    elif defined _BSD_SOURCE || defined _GNU_SOURCE
+#        define TD__HAVE_SYSCALL
+#    endif
+#endif
+
+#if defined PLATFORM_WIN && defined COMPILER_MS
+#    pragma comment(lib, "synchronization.lib")
+#endif
+
+#if defined PLATFORM_MACOS
+#    include <mach/mach_time.h>
+#endif
+
+#if defined PLATFORM_LINUX && defined TD__HAVE_SYSCALL
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    define TD__HAVE_PERF
+#endif
+
+#if defined ARCH_X64 || defined ARCH_X86
+#    include <immintrin.h>
+#    if defined COMPILER_GNU || defined COMPILER_CLANG
+#        include <cpuid.h>
+#    endif
+#elif defined ARCH_ARM64
+#    include <arm_neon.h>
+#endif
 
 TD_LIBDEF TD_String_View
 td_string_view_from_string(TD_String *str)
@@ -327,9 +2156,7 @@ TD_LIBDEF bool
 td_string_view_equal(TD_String_View a, TD_String_View b)
 {
     if (a.size != b.size) return false;
-    for (size_t i = 0; i < a.size; i++)
-        if (a.data[i] != b.data[i]) return false;
-    return true;
+    return a.size == 0 || memcmp(a.data, b.data, a.size) == 0;
 }
 
 TD_LIBDEF TD_String_View
@@ -341,11 +2168,13 @@ td_string_view_slice(const TD_String_View v, size_t start, size_t end)
     return (TD_String_View) { v.data + start, end - start };
 }
 
+/* Dispatched, see td_cpu_features */
+internal size_t td__find_byte(const char*, size_t, char);
+
 TD_LIBDEF TD_String_View
 td_string_view_chop(TD_String_View *v, char delim)
 {
-    size_t i = 0;
-    while (i < v->size && v->data[i] != delim) i++;
+    size_t i = td__find_byte(v->data, v->size, delim);
 
     TD_String_View out = { v->data, i };
 
@@ -360,11 +2189,18 @@ td_string_view_chop(TD_String_View *v, char delim)
     return out;
 }
 
+/* isspace in the C locale, without the call and the locale lookup */
+internal TD_FORCE_INLINE bool
+td__is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
 TD_LIBDEF TD_String_View
 td_string_view_trim_left(TD_String_View v)
 {
     size_t i = 0;
-    while (i < v.size && isspace((unsigned char)v.data[i]))
+    while (i < v.size && td__is_space(v.data[i]))
         ++i;
     return (TD_String_View){ v.data + i, v.size - i };
 }
@@ -373,7 +2209,7 @@ TD_LIBDEF TD_String_View
 td_string_view_trim_right(TD_String_View v)
 {
     size_t end = v.size;
-    while (end > 0 && isspace((unsigned char)v.data[end - 1]))
+    while (end > 0 && td__is_space(v.data[end - 1]))
         --end;
     return (TD_String_View){ v.data, end };
 }
@@ -399,25 +2235,5433 @@ td_string_slice(const TD_String *str,
 TD_LIBDEF bool
 td_read_file_to_string(TD_String *str, FILE *fp)
 {
-    i32 file_size;
+    return td_read_file_to_string_ex(str, fp, 0);
+}
+
+/* glibc only exposes O_DIRECT under _GNU_SOURCE. The kernel doesn't care. */
+#if defined PLATFORM_LINUX && !defined O_DIRECT && defined __O_DIRECT
+#    define O_DIRECT __O_DIRECT
+#endif
+
+TD_LIBDEF void
+td_file_advise(int fd, u32 hints)
+{
+#if defined POSIX_FADV_SEQUENTIAL
+    if (hints & TD_HINT_SEQUENTIAL)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (hints & TD_HINT_WILLNEED)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined PLATFORM_MACOS
+    if (hints & TD_HINT_SEQUENTIAL)
+        fcntl(fd, F_RDAHEAD, 1);
+    if (hints & (TD_HINT_DONTNEED | TD_HINT_DIRECT))
+        fcntl(fd, F_NOCACHE, 1);
+#else
+    (void)fd;
+    (void)hints;
+#endif
+}
+
+/* Called once the data has been consumed. */
+internal void
+td__file_release(int fd, u32 hints)
+{
+#if defined POSIX_FADV_DONTNEED
+    if (hints & (TD_HINT_DONTNEED | TD_HINT_DIRECT))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+    (void)hints;
+#endif
+}
+
+TD_LIBDEF bool
+td_read_file_to_string_ex(TD_String *str, FILE *fp, u32 hints)
+{
+    i64 file_size;
     size_t read;
 
     if (fseek(fp, 0, SEEK_END) != 0)
         return false;
 
-    file_size = ftell(fp);
+#if defined PLATFORM_WIN
+    file_size = _ftelli64(fp);
+#else
+    file_size = (i64)ftello(fp);
+#endif
     if (file_size < 0)
         return false;
 
     rewind(fp);
 
+#if defined PLATFORM_POSIX
+    if (hints) td_file_advise(fileno(fp), hints);
+#endif
+
     td__vec_alloc(str, (size_t)file_size);
     read = fread(str->data, 1, (size_t)file_size, fp);
+
+#if defined PLATFORM_POSIX
+    if (hints) td__file_release(fileno(fp), hints);
+#endif
+
     if (read != (size_t)file_size)
         return false;
 
+    td__metric_add(&td_metric_bytes_read, read);
     str->size = read;
     return true;
 }
 
-#endif /* TDLIB_IMPLEMENTATION */
+TD_LIBDEF bool
+td_try_read_file_to_string(TD_String *str, FILE *fp, TD_Budget *budget)
+{
+    i64 file_size;
+    size_t read;
+
+    if (fseek(fp, 0, SEEK_END) != 0)
+        return false;
+
+#if defined PLATFORM_WIN
+    file_size = _ftelli64(fp);
+#else
+    file_size = (i64)ftello(fp);
+#endif
+    if (file_size < 0)
+        return false;
+
+    rewind(fp);
+
+    if (!td_vec_try_reserve(str, (size_t)file_size, budget))
+        return false;
+
+    read = fread(str->data, 1, (size_t)file_size, fp);
+    if (read != (size_t)file_size)
+        return false;
+
+    td__metric_add(&td_metric_bytes_read, read);
+    str->size = read;
+    return true;
+}
+
+#if defined PLATFORM_POSIX && (defined O_DIRECT || defined F_NOCACHE)
+/* Reads to end of file through an aligned bounce buffer. O_DIRECT wants the
+   buffer, the length and the offset aligned to the logical block size, and
+   TD_DIRECTSZ bytes at a 4096 boundary keeps all three happy. On failure
+   str is left empty and errno is that of the failed read. */
+internal bool
+td__read_direct(TD_String *str, int fd)
+{
+    char *buf = td_aligned_alloc(TD_DIRECTSZ, 4096);
+    if (buf == NULL)
+        return false;
+
+    str->size = 0;
+    for (;;) {
+        ssize_t got = read(fd, buf, TD_DIRECTSZ);
+        if (got < 0) {
+            int err = errno;
+            if (err == EINTR) continue;
+            td_aligned_free(buf);
+            str->size = 0;
+            errno = err;
+            return false;
+        }
+        if (got == 0) break;
+
+        td__metric_add(&td_metric_bytes_read, (u64)got);
+        td_vec_append_bulk(str, buf, (size_t)got);
+    }
+
+    td_aligned_free(buf);
+    return true;
+}
+#endif
+
+TD_LIBDEF bool
+td_read_path_to_string(TD_String *str, const char *path, u32 hints)
+{
+#if defined PLATFORM_POSIX
+    int fd = -1;
+    bool ok;
+
+#    if defined O_DIRECT
+    if (hints & TD_HINT_DIRECT) {
+        fd = open(path, O_RDONLY | O_DIRECT);
+        if (fd >= 0) {
+            int err;
+            ok = td__read_direct(str, fd);
+            err = errno;
+            close(fd);
+            /* Some filesystems take O_DIRECT at open and refuse it with
+               EINVAL at read time. Those get the buffered path too. */
+            if (ok || err != EINVAL) {
+                errno = err;
+                return ok;
+            }
+        }
+    }
+#    elif defined F_NOCACHE
+    if (hints & TD_HINT_DIRECT) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+        fcntl(fd, F_NOCACHE, 1);
+        ok = td__read_direct(str, fd);
+        close(fd);
+        return ok;
+    }
+#    endif
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+    ok = td_read_file_to_string_ex(str, fp, hints);
+    fclose(fp);
+    return ok;
+#else
+    FILE *fp = fopen(path, "rb");
+    bool ok;
+
+    if (fp == NULL) return false;
+    ok = td_read_file_to_string_ex(str, fp, hints);
+    fclose(fp);
+    return ok;
+#endif
+}
+
+TD_LIBDEF void
+td_writer_init_fd(TD_Writer *w, int fd)
+{
+    *w = (TD_Writer){ .fd = fd, .fp = NULL };
+}
+
+TD_LIBDEF void
+td_writer_init_file(TD_Writer *w, FILE *fp)
+{
+    *w = (TD_Writer){ .fd = -1, .fp = fp };
+}
+
+/* Writes everything or fails. Short writes and EINTR are retried. */
+internal bool
+td__write_all(TD_Writer *w, const char *p, size_t n)
+{
+    if (w->fp != NULL) {
+        if (fwrite(p, 1, n, w->fp) != n) return false;
+        td__metric_add(&td_metric_bytes_written, n);
+        return true;
+    }
+
+    while (n > 0) {
+#if defined PLATFORM_WIN
+        int chunk = n > 0x40000000 ? 0x40000000 : (int)n;
+        int written = _write(w->fd, p, (unsigned)chunk);
+#else
+        ssize_t written = write(w->fd, p, n);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        td__metric_add(&td_metric_bytes_written, (u64)written);
+        p += written;
+        n -= (size_t)written;
+    }
+    return true;
+}
+
+#if defined PLATFORM_POSIX
+#    ifndef IOV_MAX
+#        define IOV_MAX 16
+#    endif
+#    define TD__IOV_BATCH (IOV_MAX < 64 ? IOV_MAX : 64)
+
+/* Same as td__write_all for a gather list. The iovec array is consumed. */
+internal bool
+td__writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        td__metric_add(&td_metric_bytes_written, (u64)written);
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+#endif
+
+TD_LIBDEF bool
+td_writer_flush(TD_Writer *w)
+{
+    if (w->failed) return false;
+
+    if (w->size > 0 && !td__write_all(w, w->data, w->size))
+        w->failed = true;
+    w->size = 0;
+
+    if (!w->failed && w->fp != NULL && fflush(w->fp) != 0)
+        w->failed = true;
+
+    return !w->failed;
+}
+
+TD_LIBDEF bool
+td_writer_write_views(TD_Writer *w, const TD_String_View *views, size_t count)
+{
+    size_t total = 0;
+
+    if (w->failed) return false;
+
+    if (w->data == NULL) {
+        w->data = TD_MALLOC(TD_WRITERSZ);
+        if (w->data == NULL) {
+            TD_PANIC("TD_MALLOC: out of memory");
+        }
+        w->alloc = TD_WRITERSZ;
+    }
+
+    for (size_t i = 0; i < count; i++) total += views[i].size;
+
+    /* The common case. Everything fits, copy and go. */
+    if (total <= w->alloc - w->size) {
+        for (size_t i = 0; i < count; i++) {
+            memcpy(w->data + w->size, views[i].data, views[i].size);
+            w->size += views[i].size;
+        }
+        return true;
+    }
+
+#if defined PLATFORM_POSIX
+    if (w->fp == NULL) {
+        struct iovec iov[TD__IOV_BATCH];
+        int n = 0;
+
+        if (w->size > 0) {
+            iov[n++] = (struct iovec){ w->data, w->size };
+            w->size = 0;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (views[i].size == 0) continue;
+            iov[n++] = (struct iovec){ views[i].data, views[i].size };
+            if (n == TD__IOV_BATCH || i + 1 == count) {
+                if (!td__writev_all(w->fd, iov, n)) {
+                    w->failed = true;
+                    return false;
+                }
+                n = 0;
+            }
+        }
+        if (n > 0 && !td__writev_all(w->fd, iov, n)) {
+            w->failed = true;
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    /* No gather writes on this target. Flush and push each piece, small ones
+       still go through the buffer. */
+    for (size_t i = 0; i < count; i++) {
+        if (views[i].size <= w->alloc - w->size) {
+            memcpy(w->data + w->size, views[i].data, views[i].size);
+            w->size += views[i].size;
+            continue;
+        }
+        if (!td_writer_flush(w)) return false;
+        if (views[i].size < w->alloc) {
+            memcpy(w->data, views[i].data, views[i].size);
+            w->size = views[i].size;
+        } else if (!td__write_all(w, views[i].data, views[i].size)) {
+            w->failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+TD_LIBDEF bool
+td_writer_write(TD_Writer *w, const void *data, size_t size)
+{
+    if (w->failed) return false;
+
+    if (w->data != NULL && size <= w->alloc - w->size) {
+        memcpy(w->data + w->size, data, size);
+        w->size += size;
+        return true;
+    }
+
+    TD_String_View v = { (char *)data, size };
+    return td_writer_write_views(w, &v, 1);
+}
+
+TD_LIBDEF bool
+td_writer_write_view(TD_Writer *w, TD_String_View v)
+{
+    return td_writer_write(w, v.data, v.size);
+}
+
+TD_LIBDEF bool
+td_writer_write_string(TD_Writer *w, const TD_String *str)
+{
+    return td_writer_write(w, str->data, str->size);
+}
+
+TD_LIBDEF bool
+td_writer_close(TD_Writer *w)
+{
+    bool ok = td_writer_flush(w);
+    TD_FREE(w->data);
+    w->data = NULL;
+    w->size = w->alloc = 0;
+    return ok;
+}
+
+/* Plain read/write loop. This is where every fast path ends up when the
+   kernel says no. */
+internal i64
+td__copy_fd_loop(int out, int in, i64 count)
+{
+    char *buf = TD_MALLOC(TD_WRITERSZ);
+    i64 copied = 0;
+
+    if (buf == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+
+    while (count < 0 || copied < count) {
+        size_t want = TD_WRITERSZ;
+        if (count >= 0 && (u64)(count - copied) < want)
+            want = (size_t)(count - copied);
+
+#if defined PLATFORM_WIN
+        int got = _read(in, buf, (unsigned)want);
+#else
+        ssize_t got = read(in, buf, want);
+#endif
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            copied = -1;
+            break;
+        }
+        if (got == 0) break;
+
+        TD_Writer w;
+        td_writer_init_fd(&w, out);
+        if (!td__write_all(&w, buf, (size_t)got)) {
+            copied = -1;
+            break;
+        }
+        copied += got;
+    }
+
+    TD_FREE(buf);
+    return copied;
+}
+
+TD_LIBDEF i64
+td_copy_fd(int out, int in, i64 count)
+{
+    i64 copied = 0;
+
+#if defined PLATFORM_LINUX
+    /* Each kernel path is tried in turn. Errors that mean "not for these
+       descriptors" move on to the next one, anything else is fatal. */
+    enum { COPY_RANGE, SEND_FILE, SPLICE, LOOP } mode = COPY_RANGE;
+
+    while (mode != LOOP && (count < 0 || copied < count)) {
+        size_t want = 1 << 30;
+        ssize_t n = -1;
+
+        if (count >= 0 && (u64)(count - copied) < want)
+            want = (size_t)(count - copied);
+
+        switch (mode) {
+#    if defined TD__HAVE_SYSCALL && defined SYS_copy_file_range
+        case COPY_RANGE:
+            n = syscall(SYS_copy_file_range, in, NULL, out, NULL, want, 0);
+            break;
+#    endif
+        case SEND_FILE:
+            n = sendfile(out, in, NULL, want);
+            break;
+#    if defined TD__HAVE_SYSCALL && defined SYS_splice
+        case SPLICE:
+            n = syscall(SYS_splice, in, NULL, out, NULL, want, 0);
+            break;
+#    endif
+        default:
+            errno = ENOSYS;
+            break;
+        }
+
+        if (n > 0) {
+            copied += n;
+            continue;
+        }
+        /* Some pseudo files report 0 to copy_file_range even though they
+           have data. Don't trust a zero from it before anything moved. */
+        if (n == 0 && mode == COPY_RANGE && copied == 0) {
+            mode++;
+            continue;
+        }
+        if (n == 0) return copied;
+        if (errno == EINTR) continue;
+
+        switch (errno) {
+        case EINVAL: case ENOSYS: case EXDEV: case EBADF:
+        case EOPNOTSUPP: case ETXTBSY: case ESPIPE:
+            mode++;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (count >= 0 && copied >= count) return copied;
+#endif
+
+    i64 rest = td__copy_fd_loop(out, in, count < 0 ? -1 : count - copied);
+    return rest < 0 ? -1 : copied + rest;
+}
+
+TD_LIBDEF bool
+td_copy_file(const char *dst, const char *src)
+{
+#if defined PLATFORM_WIN
+    return CopyFileA(src, dst, FALSE) != 0;
+#else
+    struct stat st;
+    int in, out;
+    i64 copied;
+
+    in = open(src, O_RDONLY);
+    if (in < 0) return false;
+
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+
+    out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    copied = td_copy_fd(out, in, (i64)st.st_size);
+
+    /* The file may have grown since fstat. Whatever is left is copied too. */
+    if (copied == (i64)st.st_size) {
+        i64 rest = td_copy_fd(out, in, -1);
+        copied = rest < 0 ? -1 : copied + rest;
+    }
+
+    close(in);
+    if (close(out) != 0) return false;
+    return copied >= 0;
+#endif
+}
+
+#if defined PLATFORM_WIN
+#    define td__follow_open(path)     _open((path), _O_RDONLY | _O_BINARY)
+#    define td__follow_close(fd)      _close(fd)
+#    define td__follow_stat           struct _stat64
+#    define td__follow_fstat(fd, st)  _fstat64((fd), (st))
+#    define td__follow_pstat(p, st)   _stat64((p), (st))
+#else
+#    define td__follow_open(path)     open((path), O_RDONLY)
+#    define td__follow_close(fd)      close(fd)
+#    define td__follow_stat           struct stat
+#    define td__follow_fstat(fd, st)  fstat((fd), (st))
+#    define td__follow_pstat(p, st)   stat((p), (st))
+#endif
+
+internal void
+td__follower_watch(TD_Follower *f)
+{
+#if defined PLATFORM_LINUX
+    if (f->inotify_fd < 0) return;
+    if (f->watch >= 0) inotify_rm_watch(f->inotify_fd, f->watch);
+    f->watch = inotify_add_watch(f->inotify_fd, f->path,
+                                 IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                 IN_DELETE_SELF);
+#else
+    (void)f;
+#endif
+}
+
+/* Opens whatever the path points to now and forgets the old offset. */
+internal bool
+td__follower_reopen(TD_Follower *f)
+{
+    td__follow_stat st;
+    int fd = td__follow_open(f->path);
+
+    if (fd < 0) return false;
+    if (td__follow_fstat(fd, &st) != 0) {
+        td__follow_close(fd);
+        return false;
+    }
+
+    if (f->fd >= 0) td__follow_close(f->fd);
+    f->fd = fd;
+    f->offset = 0;
+    f->device = (u64)st.st_dev;
+    f->inode = (u64)st.st_ino;
+    td__follower_watch(f);
+    return true;
+}
+
+TD_LIBDEF bool
+td_follower_open(TD_Follower *f, const char *path)
+{
+    size_t len = strlen(path);
+
+    *f = (TD_Follower){ .fd = -1, .inotify_fd = -1, .watch = -1 };
+
+    f->path = TD_MALLOC(len + 1);
+    if (f->path == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memcpy(f->path, path, len + 1);
+
+#if defined PLATFORM_LINUX
+    f->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+    if (!td__follower_reopen(f)) {
+        td_follower_close(f);
+        return false;
+    }
+    return true;
+}
+
+/* Appends everything between the offset and end of file. */
+internal i64
+td__follower_drain(TD_Follower *f, TD_String *str)
+{
+    i64 total = 0;
+
+    for (;;) {
+        td__vec_alloc(str, str->size + TD_WRITERSZ);
+
+#if defined PLATFORM_WIN
+        if (_lseeki64(f->fd, (__int64)f->offset, SEEK_SET) < 0) return -1;
+        int got = _read(f->fd, str->data + str->size, TD_WRITERSZ);
+#else
+        ssize_t got = pread(f->fd, str->data + str->size, TD_WRITERSZ,
+                            (off_t)f->offset);
+#endif
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) return total;
+
+        td__metric_add(&td_metric_bytes_read, (u64)got);
+        str->size += (size_t)got;
+        f->offset += (u64)got;
+        total += got;
+    }
+}
+
+TD_LIBDEF i64
+td_follower_read(TD_Follower *f, TD_String *str)
+{
+    td__follow_stat st;
+    i64 total = 0, got;
+
+    if (td__follow_fstat(f->fd, &st) != 0) return -1;
+    if ((u64)st.st_size < f->offset) f->offset = 0;
+
+    got = td__follower_drain(f, str);
+    if (got < 0) return -1;
+    total += got;
+
+    /* A missing path means the file was moved away and the new one is not
+       there yet. Keep the old one until it shows up. */
+    if (td__follow_pstat(f->path, &st) == 0 &&
+        ((u64)st.st_dev != f->device || (u64)st.st_ino != f->inode)) {
+        if (!td__follower_reopen(f)) return total;
+        got = td__follower_drain(f, str);
+        if (got < 0) return -1;
+        total += got;
+    }
+
+    return total;
+}
+
+TD_LIBDEF i64
+td_follower_wait(TD_Follower *f, TD_String *str, i32 timeout_ms)
+{
+    for (;;) {
+        i64 got = td_follower_read(f, str);
+        if (got != 0) return got;
+        if (timeout_ms == 0) return 0;
+
+        i32 slice = TD_FOLLOWPOLLMS;
+        if (timeout_ms > 0 && timeout_ms < slice) slice = timeout_ms;
+
+#if defined PLATFORM_LINUX
+        if (f->inotify_fd >= 0 && f->watch >= 0) {
+            char events[4096];
+            struct pollfd pfd = { f->inotify_fd, POLLIN, 0 };
+            if (poll(&pfd, 1, slice) > 0)
+                while (read(f->inotify_fd, events, sizeof(events)) > 0) {}
+        } else {
+            poll(NULL, 0, slice);
+        }
+#elif defined PLATFORM_WIN
+        Sleep((DWORD)slice);
+#else
+        poll(NULL, 0, slice);
+#endif
+
+        if (timeout_ms > 0) timeout_ms -= slice;
+    }
+}
+
+TD_LIBDEF void
+td_follower_close(TD_Follower *f)
+{
+    if (f->fd >= 0) td__follow_close(f->fd);
+#if defined PLATFORM_LINUX
+    if (f->inotify_fd >= 0) close(f->inotify_fd);
+#endif
+    TD_FREE(f->path);
+    *f = (TD_Follower){ .fd = -1, .inotify_fd = -1, .watch = -1 };
+}
+
+#define TD__VEC_MAGIC "tdvec\0\0\1"
+
+/* Fixed 64 bytes on disk. Bump the magic if this ever changes. */
+typedef struct {
+    char magic[8];
+    u32  version;
+    u32  elem_size;
+    u64  count;
+    u8   reserved[40];
+} TD__Vec_Header;
+
+internal bool
+td__vec_header_ok(const TD__Vec_Header *h, u32 version, size_t elem_size,
+                  u64 file_size)
+{
+    if (memcmp(h->magic, TD__VEC_MAGIC, sizeof(h->magic)) != 0) return false;
+    if (h->version != version || h->elem_size != elem_size) return false;
+    if (elem_size > 0 && h->count > (file_size - sizeof(*h)) / elem_size)
+        return false;
+    return true;
+}
+
+TD_LIBDEF bool
+td__vec_save(const char *path, u32 version, const void *data,
+             size_t elem_size, size_t count)
+{
+    TD__Vec_Header h = { .version = version, .elem_size = (u32)elem_size,
+                         .count = count };
+    FILE *fp;
+    bool ok;
+
+    memcpy(h.magic, TD__VEC_MAGIC, sizeof(h.magic));
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) return false;
+
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    if (ok && count > 0)
+        ok = fwrite(data, elem_size, count, fp) == count;
+
+    if (fclose(fp) != 0) ok = false;
+    return ok;
+}
+
+TD_LIBDEF void *
+td__vec_load(const char *path, u32 version, size_t elem_size,
+             void *data, size_t *size, size_t *alloc)
+{
+    TD__Vec_Header h;
+    FILE *fp;
+    i64 file_size;
+    bool ok = false;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        *size = (size_t)-1;
+        return data;
+    }
+
+#if defined PLATFORM_WIN
+    if (_fseeki64(fp, 0, SEEK_END) != 0) goto out;
+    file_size = _ftelli64(fp);
+#else
+    if (fseeko(fp, 0, SEEK_END) != 0) goto out;
+    file_size = (i64)ftello(fp);
+#endif
+    if (file_size < (i64)sizeof(h)) goto out;
+    rewind(fp);
+
+    if (fread(&h, sizeof(h), 1, fp) != 1) goto out;
+    if (!td__vec_header_ok(&h, version, elem_size, (u64)file_size)) goto out;
+
+    if (h.count > *alloc)
+        data = td__vec_grow(data, alloc, elem_size, (size_t)h.count, TD__SITE);
+
+    if (fread(data, elem_size, (size_t)h.count, fp) != h.count) goto out;
+    ok = true;
+
+out:
+    fclose(fp);
+    *size = ok ? (size_t)h.count : (size_t)-1;
+    return data;
+}
+
+TD_LIBDEF void *
+td__vec_map(const char *path, u32 version, size_t elem_size,
+            TD_Mapping *m, size_t *size)
+{
+    *m = (TD_Mapping){ 0 };
+    *size = 0;
+
+#if defined PLATFORM_WIN
+    HANDLE file, map;
+    LARGE_INTEGER len;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    if (!GetFileSizeEx(file, &len) || len.QuadPart < (i64)sizeof(TD__Vec_Header)) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (map == NULL) return NULL;
+
+    m->base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(map);
+    if (m->base == NULL) return NULL;
+    m->size = (size_t)len.QuadPart;
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    void *base;
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TD__Vec_Header)) {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    m->base = base;
+    m->size = (size_t)st.st_size;
+#endif
+
+    const TD__Vec_Header *h = m->base;
+    if (!td__vec_header_ok(h, version, elem_size, m->size)) {
+        td_unmap(m);
+        return NULL;
+    }
+
+    *size = (size_t)h->count;
+    return (char *)m->base + sizeof(*h);
+}
+
+TD_LIBDEF void
+td_unmap(TD_Mapping *m)
+{
+    if (m->base == NULL) return;
+#if defined PLATFORM_WIN
+    UnmapViewOfFile(m->base);
+#else
+    munmap(m->base, m->size);
+#endif
+    *m = (TD_Mapping){ 0 };
+}
+
+#if defined PLATFORM_WIN
+typedef HANDLE             td__thread;
+typedef SRWLOCK            td__mutex;
+typedef CONDITION_VARIABLE td__cond;
+#    define td__mutex_init(m)    InitializeSRWLock(m)
+#    define td__mutex_free(m)    ((void)(m))
+#    define td__mutex_lock(m)    AcquireSRWLockExclusive(m)
+#    define td__mutex_unlock(m)  ReleaseSRWLockExclusive(m)
+#    define td__cond_init(c)     InitializeConditionVariable(c)
+#    define td__cond_free(c)     ((void)(c))
+#    define td__cond_wait(c, m)  SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#    define td__cond_signal(c)   WakeConditionVariable(c)
+#    define td__cond_bcast(c)    WakeAllConditionVariable(c)
+#    define td__thread_yield()   SwitchToThread()
+#else
+typedef pthread_t          td__thread;
+typedef pthread_mutex_t    td__mutex;
+typedef pthread_cond_t     td__cond;
+#    define td__mutex_init(m)    pthread_mutex_init((m), NULL)
+#    define td__mutex_free(m)    pthread_mutex_destroy(m)
+#    define td__mutex_lock(m)    pthread_mutex_lock(m)
+#    define td__mutex_unlock(m)  pthread_mutex_unlock(m)
+#    define td__cond_init(c)     pthread_cond_init((c), NULL)
+#    define td__cond_free(c)     pthread_cond_destroy(c)
+#    define td__cond_wait(c, m)  pthread_cond_wait((c), (m))
+#    define td__cond_signal(c)   pthread_cond_signal(c)
+#    define td__cond_bcast(c)    pthread_cond_broadcast(c)
+#    define td__thread_yield()   sched_yield()
+#endif
+
+/* A thief can read a slot the owner is overwriting after the ring wrapped.
+   It throws the copy away when its cas on top fails, but the read itself
+   still has to be atomic, so slots are copied a word at a time with relaxed
+   loads and stores. Those are plain moves. */
+typedef struct {
+    TD_Atomic_U32 words[sizeof(TD_Job) / sizeof(u32)];
+} TD__Job_Slot;
+
+/* Chase-Lev work stealing deque with a fixed ring. The owner pushes and pops
+   at bottom, thieves take from top. top and bottom live on separate cache
+   lines so that thieves don't bounce the owner's line on every pop. */
+typedef struct {
+    TD_Atomic_U64 top;
+    char          pad0[64 - sizeof(u64)];
+    TD_Atomic_U64 bottom;
+    char          pad1[64 - sizeof(u64)];
+    TD__Job_Slot  jobs[TD_JOBDEQUESZ];
+} TD__Job_Deque;
+
+typedef struct {
+    TD__Job_Deque  deque;
+    TD_Job_Pool   *pool;
+    td__thread     thread;
+    u32            index;
+    u32            rng;
+} TD__Job_Worker;
+
+struct TD_Job_Pool {
+    TD__Job_Worker *workers;
+    u32             count;
+
+    /* Jobs from threads that are not workers of this pool */
+    td__mutex       lock;
+    td__cond        wake;
+    TD_Job         *inject;
+    size_t          inject_head, inject_size, inject_alloc;
+
+    TD_Atomic_U64   pending;    /* queued, not yet taken */
+    TD_Atomic_U64   sleepers;
+    TD_Atomic_U32   stop;
+};
+
+global_variable TD_THREAD_LOCAL TD__Job_Worker *td__job_self;
+
+internal void
+td__job_slot_store(TD__Job_Slot *slot, TD_Job job)
+{
+    u32 words[sizeof(TD_Job) / sizeof(u32)];
+
+    memcpy(words, &job, sizeof(job));
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        td_atomic_store_u32(&slot->words[i], words[i], TD_RELAXED);
+}
+
+internal TD_Job
+td__job_slot_load(TD__Job_Slot *slot)
+{
+    u32 words[sizeof(TD_Job) / sizeof(u32)];
+    TD_Job job;
+
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        words[i] = td_atomic_load_u32(&slot->words[i], TD_RELAXED);
+    memcpy(&job, words, sizeof(job));
+    return job;
+}
+
+/* Orders follow Le et al., "Correct and Efficient Work-Stealing for Weak
+   Memory Models". Indices are signed because bottom dips below top for a
+   moment when the owner pops from an empty deque. */
+internal bool
+td__deque_push(TD__Job_Deque *d, TD_Job job)
+{
+    i64 b = (i64)td_atomic_load_u64(&d->bottom, TD_RELAXED);
+    i64 t = (i64)td_atomic_load_u64(&d->top, TD_ACQUIRE);
+
+    if (b - t >= TD_JOBDEQUESZ) return false;
+
+    td__job_slot_store(&d->jobs[b & (TD_JOBDEQUESZ - 1)], job);
+    td_atomic_store_u64(&d->bottom, b + 1, TD_RELEASE);
+    return true;
+}
+
+internal bool
+td__deque_pop(TD__Job_Deque *d, TD_Job *job)
+{
+    i64 b = (i64)td_atomic_load_u64(&d->bottom, TD_RELAXED) - 1;
+    i64 t;
+
+    td_atomic_store_u64(&d->bottom, b, TD_RELAXED);
+    td_atomic_fence(TD_SEQ_CST);
+    t = (i64)td_atomic_load_u64(&d->top, TD_RELAXED);
+
+    if (t > b) {
+        td_atomic_store_u64(&d->bottom, b + 1, TD_RELAXED);
+        return false;
+    }
+
+    *job = td__job_slot_load(&d->jobs[b & (TD_JOBDEQUESZ - 1)]);
+    if (t == b) {
+        /* Last one. Race the thieves for it. */
+        u64 expect = (u64)t;
+        bool won = td_atomic_cas_u64(&d->top, &expect, t + 1, TD_SEQ_CST);
+        td_atomic_store_u64(&d->bottom, b + 1, TD_RELAXED);
+        return won;
+    }
+    return true;
+}
+
+internal bool
+td__deque_steal(TD__Job_Deque *d, TD_Job *job)
+{
+    i64 t = (i64)td_atomic_load_u64(&d->top, TD_ACQUIRE);
+    td_atomic_fence(TD_SEQ_CST);
+    i64 b = (i64)td_atomic_load_u64(&d->bottom, TD_ACQUIRE);
+    u64 expect = (u64)t;
+
+    if (t >= b) return false;
+
+    *job = td__job_slot_load(&d->jobs[t & (TD_JOBDEQUESZ - 1)]);
+    return td_atomic_cas_u64(&d->top, &expect, t + 1, TD_SEQ_CST);
+}
+
+internal bool
+td__job_inject_pop(TD_Job_Pool *pool, TD_Job *job)
+{
+    bool got = false;
+
+    td__mutex_lock(&pool->lock);
+    if (pool->inject_size > 0) {
+        *job = pool->inject[pool->inject_head];
+        pool->inject_head = (pool->inject_head + 1) % pool->inject_alloc;
+        pool->inject_size--;
+        got = true;
+    }
+    td__mutex_unlock(&pool->lock);
+    return got;
+}
+
+/* Own deque first, then the shared queue, then everybody else's deque
+   starting at a random victim. */
+internal bool
+td__job_next(TD_Job_Pool *pool, TD__Job_Worker *self, TD_Job *job)
+{
+    u32 start = 0;
+
+    if (td_atomic_load_u64(&pool->pending, TD_SEQ_CST) == 0) return false;
+
+    if (self != NULL) {
+        if (td__deque_pop(&self->deque, job)) goto found;
+
+        self->rng ^= self->rng << 13;
+        self->rng ^= self->rng >> 17;
+        self->rng ^= self->rng << 5;
+        start = self->rng;
+    }
+
+    if (td__job_inject_pop(pool, job)) goto found;
+
+    for (u32 i = 0; i < pool->count; i++) {
+        TD__Job_Worker *victim = &pool->workers[(start + i) % pool->count];
+        if (victim == self) continue;
+        if (td__deque_steal(&victim->deque, job)) goto found;
+    }
+    return false;
+
+found:
+    td_atomic_fetch_add_u64(&pool->pending, -1, TD_SEQ_CST);
+    return true;
+}
+
+internal void
+td__job_run(TD_Job job)
+{
+    job.fn(job.arg);
+    if (job.group != NULL)
+        td_atomic_fetch_add_u64(&job.group->pending, -1, TD_RELEASE);
+}
+
+#if defined PLATFORM_WIN
+internal DWORD WINAPI
+#else
+internal void *
+#endif
+td__job_worker_main(void *arg)
+{
+    TD__Job_Worker *self = arg;
+    TD_Job_Pool *pool = self->pool;
+    TD_Job job;
+
+    td__job_self = self;
+
+    for (;;) {
+        if (td__job_next(pool, self, &job)) {
+            td__job_run(job);
+            continue;
+        }
+
+        /* sleepers goes up before pending is checked and submitters bump
+           pending before they look at sleepers. Whichever way the race
+           goes, somebody sees the other one. */
+        td__mutex_lock(&pool->lock);
+        td_atomic_fetch_add_u64(&pool->sleepers, 1, TD_SEQ_CST);
+        while (td_atomic_load_u64(&pool->pending, TD_SEQ_CST) == 0 &&
+               !td_atomic_load_u32(&pool->stop, TD_ACQUIRE))
+            td__cond_wait(&pool->wake, &pool->lock);
+        td_atomic_fetch_add_u64(&pool->sleepers, -1, TD_SEQ_CST);
+        td__mutex_unlock(&pool->lock);
+
+        if (td_atomic_load_u32(&pool->stop, TD_ACQUIRE) &&
+            td_atomic_load_u64(&pool->pending, TD_SEQ_CST) == 0)
+            break;
+    }
+
+    td__job_self = NULL;
+    return 0;
+}
+
+internal u32
+td__cpu_count(void)
+{
+#if defined PLATFORM_WIN
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (u32)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (u32)n : 1;
+#endif
+}
+
+TD_LIBDEF TD_Job_Pool *
+td_job_pool_create(u32 count)
+{
+    TD_Job_Pool *pool;
+
+    if (count == 0) count = td__cpu_count();
+
+    pool = TD_MALLOC(sizeof(*pool));
+    if (pool == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    pool->workers = TD_MALLOC(count * sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memset(pool->workers, 0, count * sizeof(*pool->workers));
+    pool->count = count;
+
+    td__mutex_init(&pool->lock);
+    td__cond_init(&pool->wake);
+
+    for (u32 i = 0; i < count; i++) {
+        TD__Job_Worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->rng = 0x9E3779B9u * (i + 1);
+#if defined PLATFORM_WIN
+        w->thread = CreateThread(NULL, 0, td__job_worker_main, w, 0, NULL);
+        if (w->thread == NULL) {
+            TD_PANIC("CreateThread: failed");
+        }
+#else
+        if (pthread_create(&w->thread, NULL, td__job_worker_main, w) != 0) {
+            TD_PANIC("pthread_create: failed");
+        }
+#endif
+    }
+
+    return pool;
+}
+
+TD_LIBDEF void
+td_job_pool_destroy(TD_Job_Pool *pool)
+{
+    td__mutex_lock(&pool->lock);
+    td_atomic_store_u32(&pool->stop, 1, TD_RELEASE);
+    td__cond_bcast(&pool->wake);
+    td__mutex_unlock(&pool->lock);
+
+    for (u32 i = 0; i < pool->count; i++) {
+#if defined PLATFORM_WIN
+        WaitForSingleObject(pool->workers[i].thread, INFINITE);
+        CloseHandle(pool->workers[i].thread);
+#else
+        pthread_join(pool->workers[i].thread, NULL);
+#endif
+    }
+
+    td__cond_free(&pool->wake);
+    td__mutex_free(&pool->lock);
+    TD_FREE(pool->inject);
+    TD_FREE(pool->workers);
+    TD_FREE(pool);
+}
+
+TD_LIBDEF u32
+td_job_pool_size(const TD_Job_Pool *pool)
+{
+    return pool->count;
+}
+
+TD_LIBDEF void
+td_job_submit(TD_Job_Pool *pool, TD_Job_Group *group, TD_Job_Fn *fn, void *arg)
+{
+    TD_Job job = { fn, arg, group };
+    TD__Job_Worker *self = td__job_self;
+
+    if (group != NULL) td_atomic_fetch_add_u64(&group->pending, 1, TD_RELAXED);
+
+    if (self != NULL && self->pool == pool) {
+        td_atomic_fetch_add_u64(&pool->pending, 1, TD_SEQ_CST);
+        if (!td__deque_push(&self->deque, job)) {
+            td_atomic_fetch_add_u64(&pool->pending, -1, TD_SEQ_CST);
+            td__job_run(job);
+            return;
+        }
+    } else {
+        td__mutex_lock(&pool->lock);
+        if (pool->inject_size == pool->inject_alloc) {
+            /* Unwrap the ring into a bigger one */
+            size_t alloc = pool->inject_alloc ? pool->inject_alloc * 2 : 64;
+            TD_Job *jobs = TD_MALLOC(alloc * sizeof(*jobs));
+            if (jobs == NULL) {
+                TD_PANIC("TD_MALLOC: out of memory");
+            }
+            for (size_t i = 0; i < pool->inject_size; i++)
+                jobs[i] = pool->inject[(pool->inject_head + i) % pool->inject_alloc];
+            TD_FREE(pool->inject);
+            pool->inject = jobs;
+            pool->inject_head = 0;
+            pool->inject_alloc = alloc;
+        }
+        pool->inject[(pool->inject_head + pool->inject_size) % pool->inject_alloc] = job;
+        pool->inject_size++;
+        td_atomic_fetch_add_u64(&pool->pending, 1, TD_SEQ_CST);
+        td__mutex_unlock(&pool->lock);
+    }
+
+    if (td_atomic_load_u64(&pool->sleepers, TD_SEQ_CST) > 0) {
+        td__mutex_lock(&pool->lock);
+        td__cond_signal(&pool->wake);
+        td__mutex_unlock(&pool->lock);
+    }
+}
+
+TD_LIBDEF void
+td_job_wait(TD_Job_Pool *pool, TD_Job_Group *group)
+{
+    TD__Job_Worker *self = td__job_self;
+    TD_Job job;
+
+    if (self != NULL && self->pool != pool) self = NULL;
+
+    if (group == NULL) return;
+
+    while (td_atomic_load_u64(&group->pending, TD_ACQUIRE) > 0) {
+        if (td__job_next(pool, self, &job))
+            td__job_run(job);
+        else
+            td__thread_yield();
+    }
+}
+
+typedef struct {
+    TD_Range_Fn  *fn;
+    void         *arg;
+    TD_Atomic_U64 next;
+    u64           end, grain;
+} TD__Parallel_For;
+
+internal void
+td__parallel_for_job(void *arg)
+{
+    TD__Parallel_For *pf = arg;
+
+    for (;;) {
+        u64 begin = td_atomic_fetch_add_u64(&pf->next, pf->grain, TD_RELAXED);
+        if (begin >= pf->end) break;
+        u64 end = pf->end - begin > pf->grain ? begin + pf->grain : pf->end;
+        pf->fn((size_t)begin, (size_t)end, pf->arg);
+    }
+}
+
+TD_LIBDEF void
+td_parallel_for(TD_Job_Pool *pool, size_t begin, size_t end, size_t grain,
+                TD_Range_Fn *fn, void *arg)
+{
+    TD__Parallel_For pf = { fn, arg, begin, end, grain };
+    TD_Job_Group group = { 0 };
+    size_t chunks, helpers;
+
+    if (begin >= end) return;
+    if (grain == 0) grain = pf.grain = 1;
+
+    chunks = (end - begin + grain - 1) / grain;
+    helpers = chunks - 1 < pool->count ? chunks - 1 : pool->count;
+
+    for (size_t i = 0; i < helpers; i++)
+        td_job_submit(pool, &group, td__parallel_for_job, &pf);
+
+    td__parallel_for_job(&pf);
+    td_job_wait(pool, &group);
+}
+
+/* td__futex_wait sleeps while *addr == expect. It may return early for any
+   reason; callers loop. td__futex_wake wakes one or all sleepers on addr. */
+#if defined PLATFORM_LINUX && defined TD__HAVE_SYSCALL && defined SYS_futex
+
+#define TD__FUTEX_WAIT_PRIVATE 128
+#define TD__FUTEX_WAKE_PRIVATE 129
+
+internal void
+td__futex_wait(TD_Atomic_U32 *addr, u32 expect)
+{
+    syscall(SYS_futex, addr, TD__FUTEX_WAIT_PRIVATE, expect, NULL, NULL, 0);
+}
+
+internal void
+td__futex_wake(TD_Atomic_U32 *addr, bool all)
+{
+    syscall(SYS_futex, addr, TD__FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1,
+            NULL, NULL, 0);
+}
+
+#elif defined PLATFORM_WIN
+
+internal void
+td__futex_wait(TD_Atomic_U32 *addr, u32 expect)
+{
+    WaitOnAddress((volatile VOID *)addr, &expect, sizeof(expect), INFINITE);
+}
+
+internal void
+td__futex_wake(TD_Atomic_U32 *addr, bool all)
+{
+    if (all) WakeByAddressAll((PVOID)addr);
+    else     WakeByAddressSingle((PVOID)addr);
+}
+
+#elif defined PLATFORM_MACOS
+
+/* Private, but it's what libc++ and the Swift runtime use */
+extern int __ulock_wait(u32 operation, void *addr, u64 value, u32 timeout);
+extern int __ulock_wake(u32 operation, void *addr, u64 wake_value);
+
+#define TD__UL_COMPARE_AND_WAIT 1
+#define TD__ULF_WAKE_ALL        0x00000100
+#define TD__ULF_NO_ERRNO        0x01000000
+
+internal void
+td__futex_wait(TD_Atomic_U32 *addr, u32 expect)
+{
+    __ulock_wait(TD__UL_COMPARE_AND_WAIT | TD__ULF_NO_ERRNO, (void *)addr,
+                 expect, 0);
+}
+
+internal void
+td__futex_wake(TD_Atomic_U32 *addr, bool all)
+{
+    __ulock_wake(TD__UL_COMPARE_AND_WAIT | TD__ULF_NO_ERRNO |
+                 (all ? TD__ULF_WAKE_ALL : 0), (void *)addr, 0);
+}
+
+#else
+
+/* No address based waiting. Hash the address onto a bucket with a mutex and
+   a condition variable. The value is checked under the bucket lock and every
+   wake takes it, so nothing is lost; sharing a bucket only costs spurious
+   wakeups. */
+#define TD__PARK_BUCKETS 64
+
+global_variable struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} td__park[TD__PARK_BUCKETS];
+global_variable pthread_once_t td__park_once = PTHREAD_ONCE_INIT;
+
+internal void
+td__park_init(void)
+{
+    for (u32 i = 0; i < TD__PARK_BUCKETS; i++) {
+        pthread_mutex_init(&td__park[i].lock, NULL);
+        pthread_cond_init(&td__park[i].cond, NULL);
+    }
+}
+
+internal u32
+td__park_bucket(TD_Atomic_U32 *addr)
+{
+    pthread_once(&td__park_once, td__park_init);
+    return (u32)(((uintptr_t)addr >> 2) * 0x9E3779B97F4A7C15ull >> 58);
+}
+
+internal void
+td__futex_wait(TD_Atomic_U32 *addr, u32 expect)
+{
+    u32 b = td__park_bucket(addr);
+    pthread_mutex_lock(&td__park[b].lock);
+    if (td_atomic_load_u32(addr, TD_SEQ_CST) == expect)
+        pthread_cond_wait(&td__park[b].cond, &td__park[b].lock);
+    pthread_mutex_unlock(&td__park[b].lock);
+}
+
+internal void
+td__futex_wake(TD_Atomic_U32 *addr, bool all)
+{
+    u32 b = td__park_bucket(addr);
+    (void)all;
+    pthread_mutex_lock(&td__park[b].lock);
+    pthread_cond_broadcast(&td__park[b].cond);
+    pthread_mutex_unlock(&td__park[b].lock);
+}
+
+#endif
+
+/* Drepper, "Futexes Are Tricky", mutex 3 with a spin phase in front. */
+TD_LIBDEF void
+td_mutex_lock(TD_Mutex *m)
+{
+    u32 c = 0;
+
+    if (td_atomic_cas_u32(&m->state, &c, 1, TD_ACQUIRE)) return;
+
+    for (u32 i = 0; i < TD_SPINCOUNT; i++) {
+        td_cpu_relax();
+        c = 0;
+        if (td_atomic_load_u32(&m->state, TD_RELAXED) == 0 &&
+            td_atomic_cas_u32(&m->state, &c, 1, TD_ACQUIRE))
+            return;
+    }
+
+    /* From here on we claim 2 so that whoever unlocks knows to wake us */
+    if (c != 2) c = td_atomic_exchange_u32(&m->state, 2, TD_ACQUIRE);
+    while (c != 0) {
+        td__futex_wait(&m->state, 2);
+        c = td_atomic_exchange_u32(&m->state, 2, TD_ACQUIRE);
+    }
+}
+
+TD_LIBDEF bool
+td_mutex_trylock(TD_Mutex *m)
+{
+    u32 c = 0;
+    return td_atomic_cas_u32(&m->state, &c, 1, TD_ACQUIRE);
+}
+
+TD_LIBDEF void
+td_mutex_unlock(TD_Mutex *m)
+{
+    if (td_atomic_exchange_u32(&m->state, 0, TD_RELEASE) == 2)
+        td__futex_wake(&m->state, false);
+}
+
+TD_LIBDEF void
+td_event_set(TD_Event *e)
+{
+    if (td_atomic_exchange_u32(&e->state, 1, TD_RELEASE) == 0)
+        td__futex_wake(&e->state, !e->auto_reset);
+}
+
+TD_LIBDEF void
+td_event_reset(TD_Event *e)
+{
+    td_atomic_store_u32(&e->state, 0, TD_RELAXED);
+}
+
+TD_LIBDEF void
+td_event_wait(TD_Event *e)
+{
+    for (;;) {
+        if (e->auto_reset) {
+            u32 set = 1;
+            if (td_atomic_cas_u32(&e->state, &set, 0, TD_ACQUIRE)) return;
+        } else if (td_atomic_load_u32(&e->state, TD_ACQUIRE)) {
+            return;
+        }
+        td__futex_wait(&e->state, 0);
+    }
+}
+
+TD_LIBDEF bool
+td_semaphore_trywait(TD_Semaphore *s)
+{
+    u32 c = td_atomic_load_u32(&s->count, TD_RELAXED);
+    while (c > 0)
+        if (td_atomic_cas_u32(&s->count, &c, c - 1, TD_ACQUIRE)) return true;
+    return false;
+}
+
+/* waiters goes up before count is looked at, and post bumps count before it
+   looks at waiters. One of the two always sees the other. */
+TD_LIBDEF void
+td_semaphore_wait(TD_Semaphore *s)
+{
+    if (td_semaphore_trywait(s)) return;
+
+    td_atomic_fetch_add_u32(&s->waiters, 1, TD_SEQ_CST);
+    while (!td_semaphore_trywait(s))
+        td__futex_wait(&s->count, 0);
+    td_atomic_fetch_add_u32(&s->waiters, -1, TD_RELAXED);
+}
+
+TD_LIBDEF void
+td_semaphore_post(TD_Semaphore *s, u32 n)
+{
+    td_atomic_fetch_add_u32(&s->count, n, TD_SEQ_CST);
+    if (td_atomic_load_u32(&s->waiters, TD_SEQ_CST) > 0)
+        td__futex_wake(&s->count, n > 1);
+}
+
+#define TD__RW_WRITER   0x40000000u
+#define TD__RW_SLEEPERS 0x80000000u
+#define TD__RW_READERS  0x3FFFFFFFu
+
+/* Before sleeping we set the sleeper bit and wait on the exact value we
+   saw, so a change between the check and the wait is never missed. */
+internal void
+td__rwlock_sleep(TD_RWLock *l, u32 seen)
+{
+    if (!(seen & TD__RW_SLEEPERS) &&
+        !td_atomic_cas_u32(&l->state, &seen, seen | TD__RW_SLEEPERS, TD_RELAXED))
+        return;
+    td__futex_wait(&l->state, seen | TD__RW_SLEEPERS);
+}
+
+TD_LIBDEF void
+td_rwlock_read_lock(TD_RWLock *l)
+{
+    for (;;) {
+        u32 s = td_atomic_load_u32(&l->state, TD_RELAXED);
+        if (!(s & TD__RW_WRITER)) {
+            if (td_atomic_cas_u32(&l->state, &s, s + 1, TD_ACQUIRE)) return;
+            continue;
+        }
+        td__rwlock_sleep(l, s);
+    }
+}
+
+TD_LIBDEF void
+td_rwlock_read_unlock(TD_RWLock *l)
+{
+    u32 s = td_atomic_fetch_add_u32(&l->state, -1, TD_RELEASE) - 1;
+
+    /* Last reader out wakes the writers, if there are any */
+    if ((s & TD__RW_READERS) == 0 && (s & TD__RW_SLEEPERS)) {
+        u32 expect = TD__RW_SLEEPERS;
+        if (td_atomic_cas_u32(&l->state, &expect, 0, TD_RELAXED))
+            td__futex_wake(&l->state, true);
+    }
+}
+
+TD_LIBDEF void
+td_rwlock_write_lock(TD_RWLock *l)
+{
+    for (;;) {
+        u32 s = td_atomic_load_u32(&l->state, TD_RELAXED);
+        if (!(s & (TD__RW_WRITER | TD__RW_READERS))) {
+            if (td_atomic_cas_u32(&l->state, &s, s | TD__RW_WRITER, TD_ACQUIRE))
+                return;
+            continue;
+        }
+        td__rwlock_sleep(l, s);
+    }
+}
+
+TD_LIBDEF void
+td_rwlock_write_unlock(TD_RWLock *l)
+{
+    if (td_atomic_exchange_u32(&l->state, 0, TD_RELEASE) & TD__RW_SLEEPERS)
+        td__futex_wake(&l->state, true);
+}
+
+#if defined PLATFORM_POSIX
+#    if !defined MAP_ANONYMOUS && defined MAP_ANON
+#        define MAP_ANONYMOUS MAP_ANON
+#    elif !defined MAP_ANONYMOUS && defined PLATFORM_LINUX
+#        define MAP_ANONYMOUS 0x20
+#    endif
+#    ifndef MAP_NORESERVE
+#        define MAP_NORESERVE 0
+#    endif
+#endif
+
+/* The reservation is inaccessible and commits go in 64 KiB steps, so a big
+   arena doesn't count against the commit limit until it is used. */
+#define TD__ARENA_COMMIT (64 * 1024)
+
+TD_LIBDEF bool
+td_arena_init(TD_Arena *arena, size_t reserve)
+{
+    *arena = (TD_Arena){ 0 };
+
+#if defined PLATFORM_WIN
+    arena->data = VirtualAlloc(NULL, reserve, MEM_RESERVE, PAGE_NOACCESS);
+    if (arena->data == NULL) return false;
+#else
+    void *p = mmap(NULL, reserve, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return false;
+    arena->data = p;
+#endif
+
+    arena->alloc = reserve;
+    return true;
+}
+
+TD_LIBDEF void
+td_arena_free(TD_Arena *arena)
+{
+    if (arena->data == NULL) return;
+#if defined PLATFORM_WIN
+    VirtualFree(arena->data, 0, MEM_RELEASE);
+#else
+    munmap(arena->data, arena->alloc);
+#endif
+    *arena = (TD_Arena){ 0 };
+}
+
+TD_LIBDEF void *
+td_arena_push(TD_Arena *arena, size_t size)
+{
+    size_t start = (arena->size + 15) & ~(size_t)15;
+
+    if (size > arena->alloc - start) {
+        TD_PANIC("td_arena_push: arena exhausted");
+    }
+
+    if (start + size > arena->committed) {
+        size_t want = (start + size + TD__ARENA_COMMIT - 1) & ~(size_t)(TD__ARENA_COMMIT - 1);
+        if (want > arena->alloc) want = arena->alloc;
+#if defined PLATFORM_WIN
+        if (VirtualAlloc(arena->data + arena->committed, want - arena->committed,
+                         MEM_COMMIT, PAGE_READWRITE) == NULL) {
+            TD_PANIC("VirtualAlloc: out of memory");
+        }
+#else
+        if (mprotect(arena->data + arena->committed, want - arena->committed,
+                     PROT_READ | PROT_WRITE) != 0) {
+            TD_PANIC("mprotect: out of memory");
+        }
+#endif
+        arena->committed = want;
+    }
+
+    arena->size = start + size;
+    return TD_ASSUME_ALIGNED(arena->data + start, 16);
+}
+
+TD_LIBDEF void
+td_arena_reset(TD_Arena *arena, size_t pos)
+{
+    if (pos < arena->size) arena->size = pos;
+}
+
+TD_LIBDEF void *
+td__arena_grow(TD_Arena *arena, void *data, size_t old_size, size_t new_size)
+{
+    u8 *p = data;
+
+    /* On top of the arena. Just move the top. */
+    if (p != NULL && p + old_size == arena->data + arena->size) {
+        arena->size -= old_size;
+        td_arena_push(arena, new_size);
+        return p;
+    }
+
+    p = td_arena_push(arena, new_size);
+    if (old_size > 0) memcpy(p, data, old_size);
+    return p;
+}
+
+global_variable TD_THREAD_LOCAL TD_Arena td__scratch[2];
+
+TD_LIBDEF TD_Scratch
+td_scratch_begin(TD_Arena **conflicts, size_t count)
+{
+    for (u32 i = 0; i < 2; i++) {
+        TD_Arena *arena = &td__scratch[i];
+        bool taken = false;
+
+        for (size_t j = 0; j < count; j++)
+            if (conflicts[j] == arena) taken = true;
+        if (taken) continue;
+
+        if (arena->data == NULL && !td_arena_init(arena, TD_SCRATCHSZ)) {
+            TD_PANIC("td_scratch_begin: cannot reserve scratch arena");
+        }
+        return (TD_Scratch){ arena, arena->size };
+    }
+
+    TD_PANIC("td_scratch_begin: both scratch arenas conflict");
+    return (TD_Scratch){ 0 };
+}
+
+TD_LIBDEF void
+td_scratch_end(TD_Scratch scratch)
+{
+    td_arena_reset(scratch.arena, scratch.pos);
+}
+
+TD_LIBDEF void
+td_scratch_thread_release(void)
+{
+    td_arena_free(&td__scratch[0]);
+    td_arena_free(&td__scratch[1]);
+}
+
+TD_LIBDEF void
+td_pool_init(TD_Pool *pool, size_t object_size)
+{
+    size_t align = object_size >= 16 ? 16 : sizeof(void *);
+
+    if (object_size < sizeof(void *)) object_size = sizeof(void *);
+    object_size = (object_size + align - 1) & ~(align - 1);
+
+    *pool = (TD_Pool){ .object_size = object_size };
+}
+
+TD_LIBDEF void *
+td_pool_get(TD_Pool *pool)
+{
+    void *p = pool->free;
+
+    if (TD_LIKELY(p != NULL)) {
+        pool->free = *(void **)p;
+        /* The caller is about to write p; the next get will want this */
+        if (pool->free != NULL) TD_PREFETCH(pool->free);
+        return p;
+    }
+
+    if (pool->object_size > pool->alloc - pool->size) {
+        /* The first 16 bytes of a chunk link it into pool->chunks */
+        size_t bytes = TD_POOLCHUNKSZ;
+        if (bytes < 16 + pool->object_size) bytes = 16 + pool->object_size;
+
+        u8 *chunk = TD_MALLOC(bytes);
+        if (chunk == NULL) {
+            TD_PANIC("TD_MALLOC: out of memory");
+        }
+        *(void **)chunk = pool->chunks;
+        pool->chunks = chunk;
+        pool->chunk = chunk;
+        pool->size = 16;
+        pool->alloc = bytes;
+    }
+
+    p = pool->chunk + pool->size;
+    pool->size += pool->object_size;
+    return p;
+}
+
+TD_LIBDEF void
+td_pool_put(TD_Pool *pool, void *p)
+{
+    *(void **)p = pool->free;
+    pool->free = p;
+}
+
+TD_LIBDEF void
+td_pool_release(TD_Pool *pool)
+{
+    void *chunk = pool->chunks;
+
+    while (chunk != NULL) {
+        void *next = *(void **)chunk;
+        TD_FREE(chunk);
+        chunk = next;
+    }
+
+    td_pool_init(pool, pool->object_size);
+}
+
+#define TD__SLAB_CLASSES 14
+#define TD__SLAB_MAX     2048
+
+global_variable const u32 td__slab_sizes[TD__SLAB_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+/* Everything shared. The free lists are per class, each under its own lock.
+   class_of maps a slab index to its class; class_for maps a size in 16 byte
+   steps to a class. */
+global_variable struct {
+    TD_Arena      region;
+    TD_Atomic_Ptr base;
+    TD_Mutex      region_lock;
+    TD_Mutex      lock[TD__SLAB_CLASSES];
+    void         *free[TD__SLAB_CLASSES];
+    u8            class_of[TD_SLABRESERVE / TD_SLABSZ];
+    u8            class_for[TD__SLAB_MAX / 16 + 1];
+} td__slab;
+
+#if TD_SLABCACHE > 0
+global_variable TD_THREAD_LOCAL struct {
+    void *head[TD__SLAB_CLASSES];
+    u32   count[TD__SLAB_CLASSES];
+} td__slab_cache;
+#endif
+
+internal u8 *
+td__slab_base(void)
+{
+    u8 *base = td_atomic_load_ptr(&td__slab.base, TD_ACQUIRE);
+    if (base != NULL) return base;
+
+    td_mutex_lock(&td__slab.region_lock);
+    base = td_atomic_load_ptr(&td__slab.base, TD_RELAXED);
+    if (base == NULL) {
+        u32 c = 0;
+        for (u32 i = 0; i <= TD__SLAB_MAX / 16; i++) {
+            while (td__slab_sizes[c] < i * 16) c++;
+            td__slab.class_for[i] = (u8)c;
+        }
+        if (!td_arena_init(&td__slab.region, TD_SLABRESERVE)) {
+            TD_PANIC("td_slab_alloc: cannot reserve slab region");
+        }
+        base = td__slab.region.data;
+        td_atomic_store_ptr(&td__slab.base, base, TD_RELEASE);
+    }
+    td_mutex_unlock(&td__slab.region_lock);
+    return base;
+}
+
+/* Called with the class lock held. Returns a list of fresh blocks or NULL
+   when the region is used up. */
+internal void *
+td__slab_carve(u32 c)
+{
+    u32 size = td__slab_sizes[c];
+    u8 *slab, *base = td__slab_base();
+    void *head = NULL;
+
+    td_mutex_lock(&td__slab.region_lock);
+    if (td__slab.region.alloc - td__slab.region.size < TD_SLABSZ) {
+        td_mutex_unlock(&td__slab.region_lock);
+        return NULL;
+    }
+    slab = td_arena_push(&td__slab.region, TD_SLABSZ);
+    td__slab.class_of[(size_t)(slab - base) / TD_SLABSZ] = (u8)c;
+    td_mutex_unlock(&td__slab.region_lock);
+
+    for (u32 off = (TD_SLABSZ / size - 1) * size;; off -= size) {
+        *(void **)(slab + off) = head;
+        head = slab + off;
+        if (off == 0) break;
+    }
+    return head;
+}
+
+/* Takes up to n blocks off the shared list of class c. Returns the first
+   one; the rest, if any, are linked behind it. */
+internal void *
+td__slab_take(u32 c, u32 n, u32 *got)
+{
+    void *head, *tail;
+    u32 count = 1;
+
+    td_mutex_lock(&td__slab.lock[c]);
+    if (td__slab.free[c] == NULL) td__slab.free[c] = td__slab_carve(c);
+
+    head = td__slab.free[c];
+    if (head == NULL) {
+        td_mutex_unlock(&td__slab.lock[c]);
+        *got = 0;
+        return NULL;
+    }
+
+    tail = head;
+    while (count < n && *(void **)tail != NULL) {
+        tail = *(void **)tail;
+        count++;
+    }
+    td__slab.free[c] = *(void **)tail;
+    *(void **)tail = NULL;
+    td_mutex_unlock(&td__slab.lock[c]);
+
+    *got = count;
+    return head;
+}
+
+internal void
+td__slab_give(u32 c, void *head, void *tail)
+{
+    td_mutex_lock(&td__slab.lock[c]);
+    *(void **)tail = td__slab.free[c];
+    td__slab.free[c] = head;
+    td_mutex_unlock(&td__slab.lock[c]);
+}
+
+TD_LIBDEF void *
+td_slab_alloc(size_t size)
+{
+    u32 c, got;
+    void *p;
+
+    if (size > TD__SLAB_MAX) return malloc(size);
+
+    td__slab_base();
+    c = td__slab.class_for[(size + 15) / 16];
+
+#if TD_SLABCACHE > 0
+    p = td__slab_cache.head[c];
+    if (p == NULL) {
+        p = td__slab_take(c, TD_SLABCACHE / 2 + 1, &got);
+        if (p == NULL) return malloc(size);
+        td__slab_cache.count[c] = got;
+    }
+    td__slab_cache.head[c] = *(void **)p;
+    td__slab_cache.count[c]--;
+#else
+    p = td__slab_take(c, 1, &got);
+    if (p == NULL) return malloc(size);
+#endif
+
+    return p;
+}
+
+internal bool
+td__slab_owns(const void *p)
+{
+    const u8 *base = td_atomic_load_ptr(&td__slab.base, TD_ACQUIRE);
+    return base != NULL && (const u8 *)p >= base &&
+           (size_t)((const u8 *)p - base) < TD_SLABRESERVE;
+}
+
+TD_LIBDEF void
+td_slab_free(void *p)
+{
+    u32 c;
+
+    if (p == NULL) return;
+    if (!td__slab_owns(p)) {
+        free(p);
+        return;
+    }
+
+    c = td__slab.class_of[(size_t)((u8 *)p - (u8 *)td__slab.base) / TD_SLABSZ];
+
+#if TD_SLABCACHE > 0
+    *(void **)p = td__slab_cache.head[c];
+    td__slab_cache.head[c] = p;
+
+    /* Full. Hand half of it back. */
+    if (++td__slab_cache.count[c] > TD_SLABCACHE) {
+        void *tail = p;
+        for (u32 i = 1; i < TD_SLABCACHE / 2; i++) tail = *(void **)tail;
+        td__slab_cache.head[c] = *(void **)tail;
+        td__slab_cache.count[c] -= TD_SLABCACHE / 2;
+        td__slab_give(c, p, tail);
+    }
+#else
+    td__slab_give(c, p, p);
+#endif
+}
+
+TD_LIBDEF void *
+td_slab_realloc(void *p, size_t size)
+{
+    size_t old;
+    void *q;
+
+    if (p == NULL) return td_slab_alloc(size);
+    if (!td__slab_owns(p)) return realloc(p, size);
+
+    old = td__slab_sizes[td__slab.class_of[(size_t)((u8 *)p - (u8 *)td__slab.base) / TD_SLABSZ]];
+    if (size <= old) return p;
+
+    q = td_slab_alloc(size);
+    if (q == NULL) return NULL;
+    memcpy(q, p, old);
+    td_slab_free(p);
+    return q;
+}
+
+TD_LIBDEF void
+td_slab_thread_flush(void)
+{
+#if TD_SLABCACHE > 0
+    for (u32 c = 0; c < TD__SLAB_CLASSES; c++) {
+        void *head = td__slab_cache.head[c], *tail = head;
+        if (head == NULL) continue;
+        while (*(void **)tail != NULL) tail = *(void **)tail;
+        td__slab_give(c, head, tail);
+        td__slab_cache.head[c] = NULL;
+        td__slab_cache.count[c] = 0;
+    }
+#endif
+}
+
+/* The books are kept whether or not TDLIB_ALLOCSTATS is on in this file;
+   other files may have it on. Site 0 catches everything once the table is
+   full. */
+#define TD__STATS_SITES 1024
+
+typedef struct {
+    const char *file;
+    int         line;
+    u64         allocs, bytes;
+    u64         live, live_bytes;
+    u64         slack;
+} TD__Alloc_Site;
+
+typedef struct {
+    u64 size;
+    u32 site;
+    u32 pad;
+} TD__Alloc_Header;
+
+global_variable struct {
+    TD_Mutex       lock;
+    u64            mallocs, reallocs, frees;
+    u64            bytes, live, live_bytes, peak_bytes;
+    u64            realloc_copied, slack;
+    u64            histogram[64];
+    TD__Alloc_Site sites[TD__STATS_SITES];
+    u32            site_count;
+} td__stats;
+
+/* Called with the lock held */
+internal u32
+td__stats_site(const char *file, int line)
+{
+    u32 h = (u32)line * 2654435761u;
+    for (const char *c = file; *c; c++) h = (h ^ (u8)*c) * 16777619u;
+
+    if (td__stats.site_count == 0) {
+        td__stats.sites[0].file = "(other)";
+        td__stats.site_count = 1;
+    }
+
+    for (u32 i = 0; i < TD__STATS_SITES - 1; i++) {
+        u32 slot = 1 + (h + i) % (TD__STATS_SITES - 1);
+        TD__Alloc_Site *s = &td__stats.sites[slot];
+        if (s->file == NULL) {
+            s->file = file;
+            s->line = line;
+            td__stats.site_count++;
+            return slot;
+        }
+        if (s->line == line && (s->file == file || strcmp(s->file, file) == 0))
+            return slot;
+    }
+    return 0;
+}
+
+internal u32
+td__stats_bucket(size_t size)
+{
+    u32 b = 0;
+    while (b < 63 && ((size_t)1 << (b + 1)) <= size) b++;
+    return b;
+}
+
+/* Called with the lock held */
+internal void
+td__stats_charge(TD__Alloc_Header *h, size_t size, const char *file, int line)
+{
+    h->size = size;
+    h->site = td__stats_site(file, line);
+
+    td__stats.bytes += size;
+    td__stats.live++;
+    td__stats.live_bytes += size;
+    if (td__stats.live_bytes > td__stats.peak_bytes)
+        td__stats.peak_bytes = td__stats.live_bytes;
+    td__stats.histogram[td__stats_bucket(size)]++;
+
+    TD__Alloc_Site *s = &td__stats.sites[h->site];
+    s->allocs++;
+    s->bytes += size;
+    s->live++;
+    s->live_bytes += size;
+}
+
+/* Called with the lock held */
+internal void
+td__stats_discharge(TD__Alloc_Header *h)
+{
+    TD__Alloc_Site *s = &td__stats.sites[h->site];
+
+    td__stats.live--;
+    td__stats.live_bytes -= h->size;
+    s->live--;
+    s->live_bytes -= h->size;
+}
+
+TD_LIBDEF void *
+td__stats_malloc(size_t size, const char *file, int line)
+{
+    TD__Alloc_Header *h = malloc(sizeof(*h) + size);
+    if (h == NULL) return NULL;
+
+    td_mutex_lock(&td__stats.lock);
+    td__stats.mallocs++;
+    td__stats_charge(h, size, file, line);
+    td_mutex_unlock(&td__stats.lock);
+
+    return h + 1;
+}
+
+TD_LIBDEF void *
+td__stats_realloc(void *p, size_t size, const char *file, int line)
+{
+    TD__Alloc_Header *old, *h;
+    TD__Alloc_Header saved;
+
+    if (p == NULL) return td__stats_malloc(size, file, line);
+
+    old = (TD__Alloc_Header *)p - 1;
+    saved = *old;
+
+    h = realloc(old, sizeof(*h) + size);
+    if (h == NULL) return NULL;
+
+    td_mutex_lock(&td__stats.lock);
+    td__stats.reallocs++;
+    td__stats_discharge(&saved);
+    if (h != old)
+        td__stats.realloc_copied += saved.size < size ? saved.size : size;
+    td__stats_charge(h, size, file, line);
+    td_mutex_unlock(&td__stats.lock);
+
+    return h + 1;
+}
+
+TD_LIBDEF void
+td__stats_free(void *p)
+{
+    TD__Alloc_Header *h;
+
+    if (p == NULL) return;
+    h = (TD__Alloc_Header *)p - 1;
+
+    td_mutex_lock(&td__stats.lock);
+    td__stats.frees++;
+    td__stats_discharge(h);
+    td_mutex_unlock(&td__stats.lock);
+
+    free(h);
+}
+
+TD_LIBDEF void
+td__stats_slack(size_t bytes, const char *file, int line)
+{
+    td_mutex_lock(&td__stats.lock);
+    td__stats.slack += bytes;
+    td__stats.sites[td__stats_site(file, line)].slack += bytes;
+    td_mutex_unlock(&td__stats.lock);
+}
+
+internal int
+td__stats_site_cmp(const void *a, const void *b)
+{
+    const TD__Alloc_Site *x = a, *y = b;
+    if (x->live_bytes != y->live_bytes) return x->live_bytes < y->live_bytes ? 1 : -1;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return 0;
+}
+
+/* Copies the used sites out sorted by live bytes, then by total bytes.
+   Called with the lock held. */
+internal u32
+td__stats_sorted(TD__Alloc_Site *out)
+{
+    u32 n = 0;
+    for (u32 i = 0; i < TD__STATS_SITES; i++)
+        if (td__stats.sites[i].file != NULL && td__stats.sites[i].allocs +
+            td__stats.sites[i].slack > 0)
+            out[n++] = td__stats.sites[i];
+    qsort(out, n, sizeof(*out), td__stats_site_cmp);
+    return n;
+}
+
+TD_LIBDEF void
+td_alloc_stats_text(FILE *fp)
+{
+    local_persist TD__Alloc_Site sites[TD__STATS_SITES];
+    u32 n;
+
+    td_mutex_lock(&td__stats.lock);
+
+    fprintf(fp, "mallocs %llu reallocs %llu frees %llu\n",
+            (unsigned long long)td__stats.mallocs,
+            (unsigned long long)td__stats.reallocs,
+            (unsigned long long)td__stats.frees);
+    fprintf(fp, "bytes %llu live %llu in %llu blocks peak %llu\n",
+            (unsigned long long)td__stats.bytes,
+            (unsigned long long)td__stats.live_bytes,
+            (unsigned long long)td__stats.live,
+            (unsigned long long)td__stats.peak_bytes);
+    fprintf(fp, "realloc copied %llu vector slack %llu\n",
+            (unsigned long long)td__stats.realloc_copied,
+            (unsigned long long)td__stats.slack);
+
+    fprintf(fp, "\nsize histogram\n");
+    for (u32 b = 0; b < 64; b++)
+        if (td__stats.histogram[b])
+            fprintf(fp, "  >= %-20llu %llu\n", 1ull << b,
+                    (unsigned long long)td__stats.histogram[b]);
+
+    fprintf(fp, "\n%-40s %10s %12s %10s %12s %12s\n", "site", "allocs",
+            "bytes", "live", "live bytes", "slack");
+    n = td__stats_sorted(sites);
+    for (u32 i = 0; i < n; i++)
+        fprintf(fp, "%-34s:%-5d %10llu %12llu %10llu %12llu %12llu\n",
+                sites[i].file, sites[i].line,
+                (unsigned long long)sites[i].allocs,
+                (unsigned long long)sites[i].bytes,
+                (unsigned long long)sites[i].live,
+                (unsigned long long)sites[i].live_bytes,
+                (unsigned long long)sites[i].slack);
+
+    td_mutex_unlock(&td__stats.lock);
+}
+
+internal void
+td__json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', fp);
+        if ((u8)*s < 0x20) fprintf(fp, "\\u%04x", (u8)*s);
+        else fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+TD_LIBDEF void
+td_alloc_stats_json(FILE *fp)
+{
+    local_persist TD__Alloc_Site sites[TD__STATS_SITES];
+    bool first = true;
+    u32 n;
+
+    td_mutex_lock(&td__stats.lock);
+
+    fprintf(fp, "{\"mallocs\":%llu,\"reallocs\":%llu,\"frees\":%llu,"
+                "\"bytes\":%llu,\"live\":%llu,\"live_bytes\":%llu,"
+                "\"peak_bytes\":%llu,\"realloc_copied\":%llu,\"slack\":%llu,",
+            (unsigned long long)td__stats.mallocs,
+            (unsigned long long)td__stats.reallocs,
+            (unsigned long long)td__stats.frees,
+            (unsigned long long)td__stats.bytes,
+            (unsigned long long)td__stats.live,
+            (unsigned long long)td__stats.live_bytes,
+            (unsigned long long)td__stats.peak_bytes,
+            (unsigned long long)td__stats.realloc_copied,
+            (unsigned long long)td__stats.slack);
+
+    fprintf(fp, "\"histogram\":{");
+    for (u32 b = 0; b < 64; b++) {
+        if (!td__stats.histogram[b]) continue;
+        fprintf(fp, "%s\"%llu\":%llu", first ? "" : ",", 1ull << b,
+                (unsigned long long)td__stats.histogram[b]);
+        first = false;
+    }
+
+    fprintf(fp, "},\"sites\":[");
+    n = td__stats_sorted(sites);
+    for (u32 i = 0; i < n; i++) {
+        fprintf(fp, "%s{\"file\":", i ? "," : "");
+        td__json_string(fp, sites[i].file);
+        fprintf(fp, ",\"line\":%d,\"allocs\":%llu,\"bytes\":%llu,"
+                    "\"live\":%llu,\"live_bytes\":%llu,\"slack\":%llu}",
+                sites[i].line,
+                (unsigned long long)sites[i].allocs,
+                (unsigned long long)sites[i].bytes,
+                (unsigned long long)sites[i].live,
+                (unsigned long long)sites[i].live_bytes,
+                (unsigned long long)sites[i].slack);
+    }
+    fprintf(fp, "]}\n");
+
+    td_mutex_unlock(&td__stats.lock);
+}
+
+#if defined PLATFORM_LINUX
+#    ifndef MAP_HUGETLB
+#        define MAP_HUGETLB 0x40000
+#    endif
+#    ifndef MADV_HUGEPAGE
+#        define MADV_HUGEPAGE 14
+#    endif
+#endif
+
+#define TD__HUGE_PAGE (2 * 1024 * 1024)
+
+enum { TD__BLOCK_MALLOC, TD__BLOCK_MAP, TD__BLOCK_HUGETLB };
+
+/* Sits right in front of the pointer we hand out. offset is the distance
+   back to what malloc or mmap returned. */
+typedef struct {
+    u64 size;
+    u32 offset;
+    u32 kind;
+} TD__Aligned_Header;
+
+global_variable TD_Atomic_U32 td__huge_mode;
+
+TD_LIBDEF void
+td_huge_pages(u32 mode)
+{
+    td_atomic_store_u32(&td__huge_mode, mode, TD_RELAXED);
+}
+
+internal void *
+td__aligned_place(u8 *raw, size_t size, size_t align, u32 kind)
+{
+    u8 *p = (u8 *)(((uintptr_t)raw + sizeof(TD__Aligned_Header) + align - 1)
+                   & ~(uintptr_t)(align - 1));
+    TD__Aligned_Header *h = (TD__Aligned_Header *)p - 1;
+
+    h->size = size;
+    h->offset = (u32)(p - raw);
+    h->kind = kind;
+    return p;
+}
+
+#if defined PLATFORM_LINUX
+/* Maps a 2 MiB aligned region big enough for the block. The slop on both
+   sides of the aligned part is given back right away. */
+internal void *
+td__huge_alloc(size_t size, size_t align, u32 mode)
+{
+    size_t need = size + (align > sizeof(TD__Aligned_Header) ? align
+                                                             : sizeof(TD__Aligned_Header));
+    size_t len = (need + TD__HUGE_PAGE - 1) & ~(size_t)(TD__HUGE_PAGE - 1);
+    u8 *raw, *base;
+
+    if (mode == TD_HUGE_TLB) {
+        raw = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (raw != MAP_FAILED)
+            return td__aligned_place(raw, size, align, TD__BLOCK_HUGETLB);
+    }
+
+    raw = mmap(NULL, len + TD__HUGE_PAGE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    base = (u8 *)(((uintptr_t)raw + TD__HUGE_PAGE - 1) & ~(uintptr_t)(TD__HUGE_PAGE - 1));
+    if (base > raw) munmap(raw, (size_t)(base - raw));
+    if (raw + len + TD__HUGE_PAGE > base + len)
+        munmap(base + len, (size_t)(raw + len + TD__HUGE_PAGE - (base + len)));
+
+    /* madvise is hidden in strict builds, same as syscall() */
+#if defined TD__HAVE_SYSCALL
+    madvise(base, len, MADV_HUGEPAGE);
+#endif
+    return td__aligned_place(base, size, align, TD__BLOCK_MAP);
+}
+#endif
+
+TD_LIBDEF void *
+td_aligned_alloc(size_t size, size_t align)
+{
+    u8 *raw;
+
+    if (align < 16) align = 16;
+
+#if defined PLATFORM_LINUX
+    u32 mode = td_atomic_load_u32(&td__huge_mode, TD_RELAXED);
+    if (mode != TD_HUGE_OFF && size >= TD_HUGESZ && align <= TD__HUGE_PAGE) {
+        void *p = td__huge_alloc(size, align, mode);
+        if (p != NULL) return p;
+    }
+#endif
+
+    raw = malloc(size + align - 1 + sizeof(TD__Aligned_Header));
+    if (raw == NULL) return NULL;
+    return td__aligned_place(raw, size, align, TD__BLOCK_MALLOC);
+}
+
+TD_LIBDEF void
+td_aligned_free(void *p)
+{
+    TD__Aligned_Header *h;
+    u8 *raw;
+
+    if (p == NULL) return;
+
+    h = (TD__Aligned_Header *)p - 1;
+    raw = (u8 *)p - h->offset;
+
+#if defined PLATFORM_POSIX
+    if (h->kind != TD__BLOCK_MALLOC) {
+        size_t len = (h->offset + h->size + TD__HUGE_PAGE - 1)
+                     & ~(size_t)(TD__HUGE_PAGE - 1);
+        munmap(raw, len);
+        return;
+    }
+#endif
+
+    free(raw);
+}
+
+TD_LIBDEF void *
+td_aligned_realloc(void *p, size_t size, size_t align)
+{
+    TD__Aligned_Header *h;
+    void *q;
+
+    if (p == NULL) return td_aligned_alloc(size, align);
+    if (align < 16) align = 16;
+
+    h = (TD__Aligned_Header *)p - 1;
+
+#if defined PLATFORM_LINUX
+    bool want_huge = size >= TD_HUGESZ &&
+                     td_atomic_load_u32(&td__huge_mode, TD_RELAXED) != TD_HUGE_OFF;
+#else
+    bool want_huge = false;
+#endif
+
+    /* Plain malloc block staying plain. Let realloc try in place, then slide
+       the data if the new block is aligned differently. */
+    if (h->kind == TD__BLOCK_MALLOC && !want_huge) {
+        u32 old_offset = h->offset;
+        u64 old_size = h->size;
+        u8 *raw = realloc((u8 *)p - old_offset,
+                          size + align - 1 + sizeof(TD__Aligned_Header));
+        u8 *at;
+        if (raw == NULL) return NULL;
+
+        /* The new header can land on top of the old payload, so move the
+           data before placing it. */
+        at = (u8 *)(((uintptr_t)raw + sizeof(TD__Aligned_Header) + align - 1)
+                    & ~(uintptr_t)(align - 1));
+        if ((size_t)(at - raw) != old_offset)
+            memmove(at, raw + old_offset, old_size < size ? old_size : size);
+        return td__aligned_place(raw, size, align, TD__BLOCK_MALLOC);
+    }
+
+    q = td_aligned_alloc(size, align);
+    if (q == NULL) return NULL;
+    memcpy(q, p, h->size < size ? h->size : size);
+    td_aligned_free(p);
+    return q;
+}
+
+/* Pooled buffers start with this. Buffers too small to hold it are not
+   pooled. */
+typedef struct TD__String_Node {
+    struct TD__String_Node *next;
+    size_t                  alloc;
+} TD__String_Node;
+
+internal u32
+td__string_class(size_t n)
+{
+    u32 c = 0;
+    while (n >>= 1) c++;
+    return c;
+}
+
+TD_LIBDEF void
+td_string_pool_init(TD_String_Pool *pool, size_t limit)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->limit = limit;
+}
+
+TD_LIBDEF TD_String
+td_string_pool_get(TD_String_Pool *pool, size_t capacity)
+{
+    TD_String str = {0};
+    size_t    alloc = TD_VECINITSZ;
+    u32       c;
+
+    if (alloc < sizeof(TD__String_Node)) alloc = sizeof(TD__String_Node);
+    while (alloc < capacity) alloc *= 2;
+
+    /* Every buffer in class c holds at least 1 << c bytes, so starting at
+       the class of the rounded up capacity never hands out a short one. */
+    for (c = td__string_class(alloc); c < sizeof(size_t) * 8; c++) {
+        TD__String_Node *node = pool->free[c];
+        if (node != NULL) {
+            pool->free[c] = node->next;
+            pool->retained -= node->alloc;
+            str.alloc = node->alloc;
+            str.data = (char *)node;
+            return str;
+        }
+    }
+
+    str.data = TD_MALLOC(alloc);
+    if (str.data == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    str.alloc = alloc;
+    return str;
+}
+
+TD_LIBDEF void
+td_string_pool_put(TD_String_Pool *pool, TD_String *str)
+{
+    if (str->alloc >= sizeof(TD__String_Node) &&
+        str->alloc <= pool->limit - pool->retained) {
+        TD__String_Node *node = (TD__String_Node *)str->data;
+        u32 c = td__string_class(str->alloc);
+
+        node->next = pool->free[c];
+        node->alloc = str->alloc;
+        pool->free[c] = node;
+        pool->retained += str->alloc;
+    } else {
+        TD_FREE(str->data);
+    }
+
+    str->data = NULL;
+    str->size = str->alloc = 0;
+}
+
+TD_LIBDEF void
+td_string_pool_release(TD_String_Pool *pool)
+{
+    for (u32 c = 0; c < sizeof(size_t) * 8; c++) {
+        TD__String_Node *node = pool->free[c];
+        while (node != NULL) {
+            TD__String_Node *next = node->next;
+            TD_FREE(node);
+            node = next;
+        }
+    }
+
+    td_string_pool_init(pool, pool->limit);
+}
+
+#if defined ARCH_X64 || defined ARCH_X86
+internal void
+td__cpuid(u32 leaf, u32 sub, u32 r[4])
+{
+#if defined COMPILER_MS
+    int v[4];
+    __cpuidex(v, (int)leaf, (int)sub);
+    for (int i = 0; i < 4; i++) r[i] = (u32)v[i];
+#else
+    __cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+internal u64
+td__xgetbv(void)
+{
+#if defined COMPILER_MS
+    return _xgetbv(0);
+#else
+    u32 lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((u64)hi << 32) | lo;
+#endif
+}
+#endif
+
+/* Bit 31 marks the mask as computed, so a CPU with no features at all
+   still only runs cpuid once */
+#define TD__CPU_KNOWN (1u << 31)
+
+global_variable TD_Atomic_U32 td__cpu_features;
+
+TD_LIBDEF u32
+td_cpu_features(void)
+{
+    u32 features = td_atomic_load_u32(&td__cpu_features, TD_RELAXED);
+    if (features & TD__CPU_KNOWN) return features & ~TD__CPU_KNOWN;
+
+    features = 0;
+#if defined ARCH_X64 || defined ARCH_X86
+    u32 r[4];
+    td__cpuid(0, 0, r);
+    u32 max_leaf = r[0];
+
+    if (max_leaf >= 1) {
+        td__cpuid(1, 0, r);
+        if (r[3] & (1u << 26)) features |= TD_CPU_SSE2;
+        if (r[2] & (1u << 20)) features |= TD_CPU_SSE42;
+        if (r[2] & (1u << 23)) features |= TD_CPU_POPCNT;
+
+        /* AVX state needs OSXSAVE and the OS saving XMM and YMM; AVX-512
+           also needs opmask and both halves of ZMM */
+        bool osxsave = (r[2] & (1u << 27)) != 0;
+        u64  xcr0 = osxsave ? td__xgetbv() : 0;
+        bool ymm = (xcr0 & 0x06) == 0x06;
+        bool zmm = (xcr0 & 0xE6) == 0xE6;
+
+        if (max_leaf >= 7) {
+            td__cpuid(7, 0, r);
+            if (ymm && (r[1] & (1u << 5)))  features |= TD_CPU_AVX2;
+            if (r[1] & (1u << 8))           features |= TD_CPU_BMI2;
+            if (zmm && (r[1] & (1u << 16))) features |= TD_CPU_AVX512F;
+            if (zmm && (r[1] & (1u << 30))) features |= TD_CPU_AVX512BW;
+        }
+    }
+#elif defined ARCH_ARM64
+    features |= TD_CPU_NEON;
+#elif defined ARCH_ARM && defined __ARM_NEON
+    features |= TD_CPU_NEON;
+#endif
+
+    td_atomic_store_u32(&td__cpu_features, features | TD__CPU_KNOWN,
+                        TD_RELAXED);
+    return features;
+}
+
+internal size_t
+td__find_byte_scalar(const char *p, size_t n, char c)
+{
+    const void *hit = memchr(p, c, n);
+    return hit != NULL ? (size_t)((const char *)hit - p) : n;
+}
+
+internal size_t
+td__count_byte_scalar(const char *p, size_t n, char c)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) count += p[i] == c;
+    return count;
+}
+
+#if defined ARCH_X64 || defined ARCH_X86
+internal u32
+td__ctz32(u32 x)
+{
+#if defined COMPILER_MS
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (u32)i;
+#else
+    return (u32)__builtin_ctz(x);
+#endif
+}
+
+/* The count kernels add the 0xFF compare masks into byte counters, which
+   subtracts one per match, and fold them with sad before 255 rounds can
+   wrap a counter. */
+TD_TARGET("sse2") internal size_t
+td__count_byte_sse2(const char *p, size_t n, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    size_t  count = 0, i = 0;
+
+    while (n - i >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        size_t  rounds = (n - i) / 16;
+        if (rounds > 255) rounds = 255;
+
+        for (size_t k = 0; k < rounds; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+        }
+
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_cvtsi128_si32(sums) +
+                 (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+
+    return count + td__count_byte_scalar(p + i, n - i, c);
+}
+
+TD_TARGET("avx2") internal size_t
+td__count_byte_avx2(const char *p, size_t n, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t  count = 0, i = 0;
+
+    while (n - i >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        size_t  rounds = (n - i) / 32;
+        if (rounds > 255) rounds = 255;
+
+        for (size_t k = 0; k < rounds; k++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, needle));
+        }
+
+        __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                                     _mm256_extracti128_si256(sums, 1));
+        count += (size_t)_mm_cvtsi128_si32(half) +
+                 (size_t)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+    }
+
+    /* GCC doesn't always clear the upper halves for a target("avx2")
+       function, and every SSE instruction after it pays for that */
+    _mm256_zeroupper();
+    return count + td__count_byte_sse2(p + i, n - i, c);
+}
+
+TD_TARGET("avx2") internal size_t
+td__find_byte_avx2(const char *p, size_t n, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t  i = 0;
+
+    for (; n - i >= 32; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            _mm256_zeroupper();
+            return i + td__ctz32(mask);
+        }
+    }
+
+    _mm256_zeroupper();
+    return i + td__find_byte_scalar(p + i, n - i, c);
+}
+#elif defined ARCH_ARM64
+internal size_t
+td__count_byte_neon(const char *p, size_t n, char c)
+{
+    uint8x16_t needle = vdupq_n_u8((u8)c);
+    size_t     count = 0, i = 0;
+
+    while (n - i >= 16) {
+        uint8x16_t acc = vdupq_n_u8(0);
+        size_t     rounds = (n - i) / 16;
+        if (rounds > 255) rounds = 255;
+
+        for (size_t k = 0; k < rounds; k++, i += 16) {
+            uint8x16_t v = vld1q_u8((const u8 *)p + i);
+            acc = vsubq_u8(acc, vceqq_u8(v, needle));
+        }
+
+        count += vaddlvq_u8(acc);
+    }
+
+    return count + td__count_byte_scalar(p + i, n - i, c);
+}
+#endif
+
+/* Filled in once by td__kernels_resolve. state is 0 before, 1 while one
+   thread resolves and 2 after. */
+global_variable struct {
+    TD_Atomic_U32 state;
+    size_t (*find_byte)(const char*, size_t, char);
+    size_t (*count_byte)(const char*, size_t, char);
+} td__kernels;
+
+internal TD_COLD TD_NOINLINE void
+td__kernels_resolve(void)
+{
+    u32 expected = 0;
+
+    if (!td_atomic_cas_u32(&td__kernels.state, &expected, 1, TD_ACQUIRE)) {
+        while (td_atomic_load_u32(&td__kernels.state, TD_ACQUIRE) != 2)
+            td_cpu_relax();
+        return;
+    }
+
+    /* memchr is usually vectorised by libc already; only beat it with AVX2 */
+    td__kernels.find_byte = td__find_byte_scalar;
+    td__kernels.count_byte = td__count_byte_scalar;
+
+#if defined ARCH_X64 || defined ARCH_X86
+    if (td_cpu_has(TD_CPU_AVX2)) {
+        td__kernels.find_byte = td__find_byte_avx2;
+        td__kernels.count_byte = td__count_byte_avx2;
+    } else if (td_cpu_has(TD_CPU_SSE2)) {
+        td__kernels.count_byte = td__count_byte_sse2;
+    }
+#elif defined ARCH_ARM64
+    td__kernels.count_byte = td__count_byte_neon;
+#endif
+
+    td_atomic_store_u32(&td__kernels.state, 2, TD_RELEASE);
+}
+
+internal size_t
+td__find_byte(const char *p, size_t n, char c)
+{
+    if (TD_UNLIKELY(td_atomic_load_u32(&td__kernels.state, TD_ACQUIRE) != 2))
+        td__kernels_resolve();
+    return td__kernels.find_byte(p, n, c);
+}
+
+TD_LIBDEF size_t
+td_string_view_count(TD_String_View v, char c)
+{
+    if (TD_UNLIKELY(td_atomic_load_u32(&td__kernels.state, TD_ACQUIRE) != 2))
+        td__kernels_resolve();
+    return td__kernels.count_byte(v.data, v.size, c);
+}
+
+TD_LIBDEF u64
+td_time_now_ns(void)
+{
+#if defined PLATFORM_WIN
+    local_persist LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+
+    /* Split so that count * 1e9 can't overflow */
+    u64 count = (u64)now.QuadPart, hz = (u64)freq.QuadPart;
+    return count / hz * 1000000000ull + count % hz * 1000000000ull / hz;
+#elif defined PLATFORM_MACOS
+    local_persist mach_timebase_info_data_t base;
+
+    if (base.denom == 0) mach_timebase_info(&base);
+    return mach_absolute_time() * base.numer / base.denom;
+#elif defined CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#else
+#    error "tdlib: no monotonic clock, include tdlib.h before system headers"
+#endif
+}
+
+global_variable TD_Atomic_U64 td__cycles_hz;
+
+TD_LIBDEF u64
+td_cycles_hz(void)
+{
+    u64 hz = td_atomic_load_u64(&td__cycles_hz, TD_RELAXED);
+    if (hz != 0) return hz;
+
+#if defined ARCH_ARM64 && defined COMPILER_MS
+    hz = (u64)_ReadStatusReg(ARM64_CNTFRQ);
+#elif defined ARCH_ARM64
+    __asm__ volatile ("mrs %0, cntfrq_el0" : "=r"(hz));
+#elif defined ARCH_X64 || defined ARCH_X86
+    /* Two threads may both measure; either answer is fine */
+    u64 t0 = td_time_now_ns(), c0 = td_cycles(), t1, c1;
+    do {
+        t1 = td_time_now_ns();
+        c1 = td_cycles();
+    } while (t1 - t0 < 10000000);
+    hz = (u64)((f64)(c1 - c0) * 1e9 / (f64)(t1 - t0));
+#else
+    hz = 1000000000ull;
+#endif
+
+    td_atomic_store_u64(&td__cycles_hz, hz, TD_RELAXED);
+    return hz;
+}
+
+TD_LIBDEF u64
+td_cycles_to_ns(u64 cycles)
+{
+    return (u64)((f64)cycles * 1e9 / (f64)td_cycles_hz());
+}
+
+TD_LIBDEF void
+td_stopwatch_start(TD_Stopwatch *sw)
+{
+    if (sw->running) return;
+    sw->start = td_time_now_ns();
+    sw->running = true;
+}
+
+TD_LIBDEF void
+td_stopwatch_stop(TD_Stopwatch *sw)
+{
+    if (!sw->running) return;
+    sw->elapsed += td_time_now_ns() - sw->start;
+    sw->running = false;
+}
+
+TD_LIBDEF void
+td_stopwatch_reset(TD_Stopwatch *sw)
+{
+    *sw = (TD_Stopwatch){0};
+}
+
+TD_LIBDEF u64
+td_stopwatch_ns(const TD_Stopwatch *sw)
+{
+    if (!sw->running) return sw->elapsed;
+    return sw->elapsed + td_time_now_ns() - sw->start;
+}
+
+#if !defined COMPILER_GNU && !defined COMPILER_CLANG
+TD__VARDEF void *volatile td__bench_sink;
+#endif
+
+/* Same order as the counter fields in TD_Bench_Result */
+#define TD__PERF_COUNT 5
+
+global_variable bool td__bench_counters;
+
+TD_LIBDEF void
+td_bench_counters(bool on)
+{
+    td__bench_counters = on;
+}
+
+/* Every counter is its own event rather than one group, so one the PMU
+   doesn't have costs us that counter and not all of them */
+internal bool
+td__perf_open(int fds[TD__PERF_COUNT])
+{
+    bool any = false;
+
+    for (int i = 0; i < TD__PERF_COUNT; i++) fds[i] = -1;
+
+#if defined TD__HAVE_PERF
+    static const struct { u32 type; u64 config; } events[TD__PERF_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    };
+
+    for (int i = 0; i < TD__PERF_COUNT; i++) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] >= 0) any = true;
+    }
+#endif
+
+    return any;
+}
+
+internal void
+td__perf_enable(int fds[TD__PERF_COUNT], bool on)
+{
+#if defined TD__HAVE_PERF
+    for (int i = 0; i < TD__PERF_COUNT; i++) {
+        if (fds[i] < 0) continue;
+        if (on) ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+#else
+    (void)fds;
+    (void)on;
+#endif
+}
+
+/* Reads, scales for multiplexing, divides by ops and closes */
+internal void
+td__perf_close(int fds[TD__PERF_COUNT], f64 ops, f64 out[TD__PERF_COUNT])
+{
+    for (int i = 0; i < TD__PERF_COUNT; i++) {
+        out[i] = -1;
+#if defined TD__HAVE_PERF
+        u64 v[3];
+
+        if (fds[i] < 0) continue;
+        if (read(fds[i], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2] > 0)
+            out[i] = (f64)v[0] * ((f64)v[1] / (f64)v[2]) / ops;
+        close(fds[i]);
+#else
+        (void)fds;
+        (void)ops;
+#endif
+    }
+}
+
+internal u64
+td__bench_once(TD_Bench_Fn *fn, void *arg, u64 iters)
+{
+    u64 t0 = td_time_now_ns();
+    fn(arg, iters);
+    return td_time_now_ns() - t0;
+}
+
+TD_LIBDEF TD_Bench_Result
+td_bench_run(const char *name, TD_Bench_Fn *fn, void *arg, u64 bytes)
+{
+    TD_Bench_Result r = { .name = name, .bytes = bytes };
+    f64 ns[TD_BENCHSAMPLES];
+    u64 iters = 1, t;
+
+    /* Warm up. Aim 20% over the target so the loop ends instead of landing
+       just under it again; never grow more than 100x on one sample. */
+    while ((t = td__bench_once(fn, arg, iters)) < TD_BENCHSAMPLENS) {
+        u64 next = t == 0 ? iters * 100
+                          : (u64)((f64)iters * 1.2 * TD_BENCHSAMPLENS / (f64)t);
+        if (next < iters * 2) next = iters * 2;
+        if (next > iters * 100) next = iters * 100;
+        iters = next;
+    }
+
+    int fds[TD__PERF_COUNT];
+    r.counted = td__bench_counters && td__perf_open(fds);
+    if (r.counted) td__perf_enable(fds, true);
+
+    for (u32 i = 0; i < TD_BENCHSAMPLES; i++) {
+        f64 v = (f64)td__bench_once(fn, arg, iters) / (f64)iters;
+        u32 j = i;
+        for (; j > 0 && ns[j - 1] > v; j--) ns[j] = ns[j - 1];
+        ns[j] = v;
+    }
+
+    if (r.counted) {
+        f64 counts[TD__PERF_COUNT];
+
+        td__perf_enable(fds, false);
+        td__perf_close(fds, (f64)iters * TD_BENCHSAMPLES, counts);
+        r.cycles = counts[0];
+        r.instructions = counts[1];
+        r.branch_misses = counts[2];
+        r.l1d_misses = counts[3];
+        r.llc_misses = counts[4];
+    }
+
+    /* Nearest rank */
+    r.iters = iters;
+    r.samples = TD_BENCHSAMPLES;
+    r.min = ns[0];
+    r.median = ns[(TD_BENCHSAMPLES * 50 + 99) / 100 - 1];
+    r.p90 = ns[(TD_BENCHSAMPLES * 90 + 99) / 100 - 1];
+    r.p99 = ns[(TD_BENCHSAMPLES * 99 + 99) / 100 - 1];
+    r.max = ns[TD_BENCHSAMPLES - 1];
+    if (bytes != 0 && r.median > 0) r.bytes_per_sec = (f64)bytes * 1e9 / r.median;
+    return r;
+}
+
+TD_LIBDEF void
+td_bench_print(FILE *fp, const TD_Bench_Result *r)
+{
+    fprintf(fp, "%-32s %12.2f ns %12.2f p90 %12.2f p99", r->name,
+            r->median, r->p90, r->p99);
+    if (r->bytes_per_sec > 0)
+        fprintf(fp, " %10.1f MB/s", r->bytes_per_sec / 1e6);
+    if (r->counted) {
+        if (r->cycles > 0 && r->instructions >= 0)
+            fprintf(fp, "  ipc %.2f", r->instructions / r->cycles);
+        if (r->branch_misses >= 0) fprintf(fp, "  br-miss %.3f", r->branch_misses);
+        if (r->l1d_misses >= 0) fprintf(fp, "  l1d-miss %.3f", r->l1d_misses);
+        if (r->llc_misses >= 0) fprintf(fp, "  llc-miss %.3f", r->llc_misses);
+    }
+    fputc('\n', fp);
+}
+
+TD_LIBDEF void
+td_bench_print_json(FILE *fp, const TD_Bench_Result *r)
+{
+    fputs("{\"name\":\"", fp);
+    for (const char *c = r->name; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', fp);
+        fputc(*c, fp);
+    }
+    fprintf(fp, "\",\"bytes\":%llu,\"iters\":%llu,\"samples\":%u,"
+            "\"min_ns\":%.3f,\"median_ns\":%.3f,\"p90_ns\":%.3f,"
+            "\"p99_ns\":%.3f,\"max_ns\":%.3f,\"bytes_per_sec\":%.0f",
+            (unsigned long long)r->bytes, (unsigned long long)r->iters,
+            r->samples, r->min, r->median, r->p90, r->p99, r->max,
+            r->bytes_per_sec);
+    if (r->counted) {
+        fprintf(fp, ",\"cycles\":%.3f,\"instructions\":%.3f,"
+                "\"branch_misses\":%.4f,\"l1d_misses\":%.4f,"
+                "\"llc_misses\":%.4f",
+                r->cycles, r->instructions, r->branch_misses, r->l1d_misses,
+                r->llc_misses);
+    }
+    fputs("}\n", fp);
+}
+
+/* name is NULL for the end of a zone. ts is in td_cycles. */
+typedef struct {
+    const char *name;
+    u64         ts;
+} TD__Zone;
+
+typedef struct TD__Zone_Buffer {
+    struct {
+        TD__Zone *data;
+        size_t    size, alloc;
+    } zones;
+    u32                     tid;
+    struct TD__Zone_Buffer *next;
+} TD__Zone_Buffer;
+
+global_variable TD_Atomic_Ptr td__zone_buffers;
+global_variable TD_Atomic_U32 td__zone_tids;
+global_variable TD_Atomic_U64 td__zone_epoch;
+
+global_variable TD_THREAD_LOCAL TD__Zone_Buffer *td__zone_buffer;
+
+internal TD_COLD TD_NOINLINE TD__Zone_Buffer *
+td__zone_register(void)
+{
+    TD__Zone_Buffer *b = TD_MALLOC(sizeof(*b));
+    if (b == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memset(b, 0, sizeof(*b));
+    b->tid = td_atomic_fetch_add_u32(&td__zone_tids, 1, TD_RELAXED) + 1;
+
+    /* The first thread in sets time zero for the trace */
+    u64 expected = 0;
+    td_atomic_cas_u64(&td__zone_epoch, &expected, td_cycles(), TD_RELAXED);
+
+    void *head = td_atomic_load_ptr(&td__zone_buffers, TD_RELAXED);
+    do {
+        b->next = head;
+    } while (!td_atomic_cas_ptr(&td__zone_buffers, &head, b, TD_RELEASE));
+
+    td__zone_buffer = b;
+    return b;
+}
+
+TD_LIBDEF void
+td__zone_begin(const char *name)
+{
+    TD__Zone_Buffer *b = td__zone_buffer;
+    if (TD_UNLIKELY(b == NULL)) b = td__zone_register();
+
+    TD__Zone z = { name, td_cycles() };
+    td_vec_append(&b->zones, z);
+}
+
+TD_LIBDEF void
+td__zone_end(void)
+{
+    u64 ts = td_cycles();
+    TD__Zone_Buffer *b = td__zone_buffer;
+    if (TD_UNLIKELY(b == NULL)) b = td__zone_register();
+
+    TD__Zone z = { NULL, ts };
+    td_vec_append(&b->zones, z);
+}
+
+TD_LIBDEF void
+td_profile_dump(FILE *fp)
+{
+    TD__Zone_Buffer *b = td_atomic_load_ptr(&td__zone_buffers, TD_ACQUIRE);
+    u64  epoch = td_atomic_load_u64(&td__zone_epoch, TD_RELAXED);
+    f64  us_per_tick = 1e6 / (f64)td_cycles_hz();
+    bool first = true;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", fp);
+    for (; b != NULL; b = b->next) {
+        for (size_t i = 0; i < b->zones.size; i++) {
+            TD__Zone *z = &b->zones.data[i];
+            f64 us = (f64)(z->ts - epoch) * us_per_tick;
+
+            fputs(first ? "\n" : ",\n", fp);
+            first = false;
+
+            if (z->name == NULL) {
+                fprintf(fp, "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                        us, b->tid);
+                continue;
+            }
+
+            fputs("{\"name\":\"", fp);
+            for (const char *c = z->name; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', fp);
+                if ((unsigned char)*c >= 0x20) fputc(*c, fp);
+            }
+            fprintf(fp, "\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    us, b->tid);
+        }
+    }
+    fputs("\n]}\n", fp);
+}
+
+TD_LIBDEF void
+td_profile_reset(void)
+{
+    TD__Zone_Buffer *b = td_atomic_load_ptr(&td__zone_buffers, TD_ACQUIRE);
+    for (; b != NULL; b = b->next) b->zones.size = 0;
+}
+
+internal u32
+td__msb64(u64 v)
+{
+#if defined COMPILER_MS && (defined ARCH_X64 || defined ARCH_ARM64)
+    unsigned long i;
+    _BitScanReverse64(&i, v);
+    return (u32)i;
+#elif defined COMPILER_MS
+    unsigned long i;
+    if (v >> 32) {
+        _BitScanReverse(&i, (unsigned long)(v >> 32));
+        return (u32)i + 32;
+    }
+    _BitScanReverse(&i, (unsigned long)v);
+    return (u32)i;
+#else
+    return 63 - (u32)__builtin_clzll(v);
+#endif
+}
+
+internal TD_FORCE_INLINE size_t
+td__hist_index(u64 v)
+{
+    if (v < ((u64)1 << TD_HISTBITS)) return (size_t)v;
+
+    u32 shift = td__msb64(v) - TD_HISTBITS;
+    return ((size_t)(shift + 1) << TD_HISTBITS) +
+           (size_t)((v >> shift) - ((u64)1 << TD_HISTBITS));
+}
+
+/* Largest value that lands in bucket i */
+internal u64
+td__hist_high(size_t i)
+{
+    if (i < ((size_t)1 << TD_HISTBITS)) return i;
+
+    u32 shift = (u32)(i >> TD_HISTBITS) - 1;
+    u64 sub = (u64)(i & (((size_t)1 << TD_HISTBITS) - 1)) + ((u64)1 << TD_HISTBITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+internal u64
+td__hist_low(size_t i)
+{
+    if (i < ((size_t)1 << TD_HISTBITS)) return i;
+
+    u32 shift = (u32)(i >> TD_HISTBITS) - 1;
+    u64 sub = (u64)(i & (((size_t)1 << TD_HISTBITS) - 1)) + ((u64)1 << TD_HISTBITS);
+    return sub << shift;
+}
+
+TD_LIBDEF void
+td_histogram_init(TD_Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = (u64)-1;
+}
+
+TD_LIBDEF void
+td_histogram_record(TD_Histogram *h, u64 value)
+{
+    h->counts[td__hist_index(value)]++;
+    h->total++;
+    h->sum += value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+TD_LIBDEF void
+td_histogram_record_n(TD_Histogram *h, u64 value, u64 n)
+{
+    if (n == 0) return;
+    h->counts[td__hist_index(value)] += n;
+    h->total += n;
+    h->sum += value * n;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+TD_LIBDEF void
+td_histogram_merge(TD_Histogram *dst, const TD_Histogram *src)
+{
+    if (src->total == 0) return;
+    for (size_t i = 0; i < TD__HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+TD_LIBDEF u64
+td_histogram_percentile(const TD_Histogram *h, f64 percentile)
+{
+    if (h->total == 0) return 0;
+    if (percentile <= 0) return h->min;
+    if (percentile >= 100) return h->max;
+
+    /* The rank of the sample asked for, counting from 1 */
+    f64 want = percentile / 100.0 * (f64)h->total;
+    u64 rank = (u64)want;
+    if ((f64)rank < want) rank++;
+    if (rank == 0) rank = 1;
+
+    u64 seen = 0;
+    for (size_t i = 0; i < TD__HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            u64 v = td__hist_high(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+TD_LIBDEF f64
+td_histogram_mean(const TD_Histogram *h)
+{
+    return h->total ? (f64)h->sum / (f64)h->total : 0;
+}
+
+global_variable const f64 td__hist_report[] = { 50, 90, 99, 99.9, 99.99 };
+
+TD_LIBDEF void
+td_histogram_print(FILE *fp, const TD_Histogram *h)
+{
+    fprintf(fp, "count %llu min %llu mean %.1f max %llu\n",
+            (unsigned long long)h->total,
+            (unsigned long long)(h->total ? h->min : 0),
+            td_histogram_mean(h), (unsigned long long)h->max);
+    for (size_t i = 0; i < sizeof(td__hist_report) / sizeof(td__hist_report[0]); i++) {
+        fprintf(fp, "  p%-6g %llu\n", td__hist_report[i],
+                (unsigned long long)td_histogram_percentile(h, td__hist_report[i]));
+    }
+}
+
+TD_LIBDEF void
+td_histogram_print_json(FILE *fp, const TD_Histogram *h)
+{
+    fprintf(fp, "{\"count\":%llu,\"min\":%llu,\"mean\":%.3f,\"max\":%llu,"
+            "\"percentiles\":{",
+            (unsigned long long)h->total,
+            (unsigned long long)(h->total ? h->min : 0),
+            td_histogram_mean(h), (unsigned long long)h->max);
+    for (size_t i = 0; i < sizeof(td__hist_report) / sizeof(td__hist_report[0]); i++) {
+        fprintf(fp, "%s\"%g\":%llu", i ? "," : "", td__hist_report[i],
+                (unsigned long long)td_histogram_percentile(h, td__hist_report[i]));
+    }
+
+    /* Non-empty buckets as [low, high, count] */
+    fputs("},\"buckets\":[", fp);
+    bool first = true;
+    for (size_t i = 0; i < TD__HIST_BUCKETS; i++) {
+        if (h->counts[i] == 0) continue;
+        fprintf(fp, "%s[%llu,%llu,%llu]", first ? "" : ",",
+                (unsigned long long)td__hist_low(i),
+                (unsigned long long)td__hist_high(i),
+                (unsigned long long)h->counts[i]);
+        first = false;
+    }
+    fputs("]}\n", fp);
+}
+
+TD__VARDEF TD_THREAD_LOCAL u32 td__counter_slot;
+
+global_variable TD_Atomic_U32 td__counter_next;
+
+/* The library's own counters are chained together here so they are in the
+   registry before anything runs */
+TD__VARDEF TD_Counter td_metric_bytes_written = { .name = "io.bytes_written" };
+TD__VARDEF TD_Counter td_metric_bytes_read = { .name = "io.bytes_read",
+                                               .next = &td_metric_bytes_written };
+TD__VARDEF TD_Counter td_metric_vec_grow_bytes = { .name = "vec.grow_bytes",
+                                                   .next = &td_metric_bytes_read };
+TD__VARDEF TD_Counter td_metric_vec_grows = { .name = "vec.grows",
+                                              .next = &td_metric_vec_grow_bytes };
+
+global_variable TD_Atomic_Ptr td__metrics = &td_metric_vec_grows;
+
+TD_LIBDEF u32
+td__counter_assign(void)
+{
+    u32 n = td_atomic_fetch_add_u32(&td__counter_next, 1, TD_RELAXED);
+    td__counter_slot = n % TD_COUNTERSHARDS + 1;
+    return td__counter_slot;
+}
+
+TD_LIBDEF u64
+td_counter_read(const TD_Counter *c)
+{
+    u64 sum = 0;
+    for (u32 i = 0; i < TD_COUNTERSHARDS; i++)
+        sum += td_atomic_load_u64((TD_Atomic_U64 *)&c->shards[i].value,
+                                  TD_RELAXED);
+    return sum;
+}
+
+TD_LIBDEF i64
+td_gauge_read(const TD_Gauge *g)
+{
+    return (i64)td_counter_read(g);
+}
+
+TD_LIBDEF void
+td_counter_register(TD_Counter *c, const char *name)
+{
+    c->name = name;
+
+    void *head = td_atomic_load_ptr(&td__metrics, TD_RELAXED);
+    do {
+        c->next = head;
+    } while (!td_atomic_cas_ptr(&td__metrics, &head, c, TD_RELEASE));
+}
+
+TD_LIBDEF void
+td_gauge_register(TD_Gauge *g, const char *name)
+{
+    g->gauge = true;
+    td_counter_register(g, name);
+}
+
+TD_LIBDEF void
+td_metrics_dump(FILE *fp)
+{
+    TD_Counter *c = td_atomic_load_ptr(&td__metrics, TD_ACQUIRE);
+
+    for (; c != NULL; c = c->next) {
+        if (c->gauge)
+            fprintf(fp, "%-32s %20lld\n", c->name, (long long)td_gauge_read(c));
+        else
+            fprintf(fp, "%-32s %20llu\n", c->name,
+                    (unsigned long long)td_counter_read(c));
+    }
+}
+
+/* Byte by byte so it is the same on any endianness; compilers turn it into
+   one load */
+internal TD_FORCE_INLINE u64
+td__load_le64(const char *p)
+{
+    const u8 *b = (const u8 *)p;
+    return (u64)b[0]       | (u64)b[1] << 8  | (u64)b[2] << 16 |
+           (u64)b[3] << 24 | (u64)b[4] << 32 | (u64)b[5] << 40 |
+           (u64)b[6] << 48 | (u64)b[7] << 56;
+}
+
+/* Every byte is 0x30..0x39: the high nibble is 3 and adding 6 doesn't carry
+   into it */
+internal TD_FORCE_INLINE bool
+td__is_eight_digits(u64 v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ull) |
+            (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ==
+           0x3333333333333333ull;
+}
+
+/* The first digit is in the low byte. Pairs, then quads, then both halves
+   are combined with one multiply each. */
+internal TD_FORCE_INLINE u64
+td__parse_eight_digits(u64 v)
+{
+    v -= 0x3030303030303030ull;
+    v = v * 10 + (v >> 8);
+    return (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+            (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+}
+
+#define td__is_digit(c) ((u8)((c) - '0') < 10)
+
+/* Parses digits at p, at most n bytes. Sets *used to the bytes consumed.
+   Leading zeros are skipped so that the first 19 significant digits, which
+   can't overflow, go through without checks. */
+internal bool
+td__parse_digits(const char *p, size_t n, size_t *used, u64 *out)
+{
+    size_t i = 0;
+    u64 v = 0;
+
+    while (i < n && p[i] == '0') i++;
+    bool any = i > 0;
+
+    size_t start = i;
+    size_t limit = n - start < 19 ? n : start + 19;
+
+    while (limit - i >= 8) {
+        u64 chunk = td__load_le64(p + i);
+        if (!td__is_eight_digits(chunk)) break;
+        v = v * 100000000 + td__parse_eight_digits(chunk);
+        i += 8;
+    }
+    while (i < limit && td__is_digit(p[i])) {
+        v = v * 10 + (u64)(p[i] - '0');
+        i++;
+    }
+
+    if (i == start && !any) {
+        errno = EINVAL;
+        return false;
+    }
+
+    /* A 20th significant digit may still fit, a 21st never does */
+    if (i < n && td__is_digit(p[i])) {
+        u64 d = (u64)(p[i] - '0');
+        if (v > ((u64)-1 - d) / 10 || (i + 1 < n && td__is_digit(p[i + 1]))) {
+            errno = ERANGE;
+            return false;
+        }
+        v = v * 10 + d;
+        i++;
+    }
+
+    *used = i;
+    *out = v;
+    return true;
+}
+
+/* Sign and magnitude; the callers check the range */
+internal bool
+td__parse_int(TD_String_View *v, bool allow_minus, bool *negative, u64 *mag)
+{
+    size_t i = 0, used;
+
+    *negative = false;
+    if (v->size > 0 && (v->data[0] == '+' || v->data[0] == '-')) {
+        if (v->data[0] == '-') {
+            if (!allow_minus) {
+                errno = EINVAL;
+                return false;
+            }
+            *negative = true;
+        }
+        i = 1;
+    }
+
+    if (!td__parse_digits(v->data + i, v->size - i, &used, mag))
+        return false;
+
+    v->data += i + used;
+    v->size -= i + used;
+    return true;
+}
+
+TD_LIBDEF bool
+td_string_view_parse_u64(TD_String_View *v, u64 *out)
+{
+    TD_String_View w = *v;
+    bool negative;
+    u64 mag;
+
+    if (!td__parse_int(&w, false, &negative, &mag)) return false;
+
+    *v = w;
+    *out = mag;
+    return true;
+}
+
+TD_LIBDEF bool
+td_string_view_parse_i64(TD_String_View *v, i64 *out)
+{
+    TD_String_View w = *v;
+    bool negative;
+    u64 mag;
+
+    if (!td__parse_int(&w, true, &negative, &mag)) return false;
+    if (mag > (u64)INT64_MAX + negative) {
+        errno = ERANGE;
+        return false;
+    }
+
+    *v = w;
+    *out = negative ? (i64)(0 - mag) : (i64)mag;
+    return true;
+}
+
+TD_LIBDEF bool
+td_string_view_parse_u32(TD_String_View *v, u32 *out)
+{
+    TD_String_View w = *v;
+    bool negative;
+    u64 mag;
+
+    if (!td__parse_int(&w, false, &negative, &mag)) return false;
+    if (mag > UINT32_MAX) {
+        errno = ERANGE;
+        return false;
+    }
+
+    *v = w;
+    *out = (u32)mag;
+    return true;
+}
+
+TD_LIBDEF bool
+td_string_view_parse_i32(TD_String_View *v, i32 *out)
+{
+    TD_String_View w = *v;
+    bool negative;
+    u64 mag;
+
+    if (!td__parse_int(&w, true, &negative, &mag)) return false;
+    if (mag > (u64)INT32_MAX + negative) {
+        errno = ERANGE;
+        return false;
+    }
+
+    *v = w;
+    *out = negative ? (i32)(0 - (u32)mag) : (i32)mag;
+    return true;
+}
+
+/* Eisel-Lemire. td__pow5_128[2 * (q + 342)] is the 128 bit power of five
+   for 10^q, normalised so the top bit is set: truncated for q >= 0 and
+   rounded up for q < 0. */
+global_variable const u64 td__pow5_128[] = {
+    0xeef453d6923bd65aull, 0x113faa2906a13b3full,
+    0x9558b4661b6565f8ull, 0x4ac7ca59a424c507ull,
+    0xbaaee17fa23ebf76ull, 0x5d79bcf00d2df649ull,
+    0xe95a99df8ace6f53ull, 0xf4d82c2c107973dcull,
+    0x91d8a02bb6c10594ull, 0x79071b9b8a4be869ull,
+    0xb64ec836a47146f9ull, 0x9748e2826cdee284ull,
+    0xe3e27a444d8d98b7ull, 0xfd1b1b2308169b25ull,
+    0x8e6d8c6ab0787f72ull, 0xfe30f0f5e50e20f7ull,
+    0xb208ef855c969f4full, 0xbdbd2d335e51a935ull,
+    0xde8b2b66b3bc4723ull, 0xad2c788035e61382ull,
+    0x8b16fb203055ac76ull, 0x4c3bcb5021afcc31ull,
+    0xaddcb9e83c6b1793ull, 0xdf4abe242a1bbf3dull,
+    0xd953e8624b85dd78ull, 0xd71d6dad34a2af0dull,
+    0x87d4713d6f33aa6bull, 0x8672648c40e5ad68ull,
+    0xa9c98d8ccb009506ull, 0x680efdaf511f18c2ull,
+    0xd43bf0effdc0ba48ull, 0x0212bd1b2566def2ull,
+    0x84a57695fe98746dull, 0x014bb630f7604b57ull,
+    0xa5ced43b7e3e9188ull, 0x419ea3bd35385e2dull,
+    0xcf42894a5dce35eaull, 0x52064cac828675b9ull,
+    0x818995ce7aa0e1b2ull, 0x7343efebd1940993ull,
+    0xa1ebfb4219491a1full, 0x1014ebe6c5f90bf8ull,
+    0xca66fa129f9b60a6ull, 0xd41a26e077774ef6ull,
+    0xfd00b897478238d0ull, 0x8920b098955522b4ull,
+    0x9e20735e8cb16382ull, 0x55b46e5f5d5535b0ull,
+    0xc5a890362fddbc62ull, 0xeb2189f734aa831dull,
+    0xf712b443bbd52b7bull, 0xa5e9ec7501d523e4ull,
+    0x9a6bb0aa55653b2dull, 0x47b233c92125366eull,
+    0xc1069cd4eabe89f8ull, 0x999ec0bb696e840aull,
+    0xf148440a256e2c76ull, 0xc00670ea43ca250dull,
+    0x96cd2a865764dbcaull, 0x380406926a5e5728ull,
+    0xbc807527ed3e12bcull, 0xc605083704f5ecf2ull,
+    0xeba09271e88d976bull, 0xf7864a44c633682eull,
+    0x93445b8731587ea3ull, 0x7ab3ee6afbe0211dull,
+    0xb8157268fdae9e4cull, 0x5960ea05bad82964ull,
+    0xe61acf033d1a45dfull, 0x6fb92487298e33bdull,
+    0x8fd0c16206306babull, 0xa5d3b6d479f8e056ull,
+    0xb3c4f1ba87bc8696ull, 0x8f48a4899877186cull,
+    0xe0b62e2929aba83cull, 0x331acdabfe94de87ull,
+    0x8c71dcd9ba0b4925ull, 0x9ff0c08b7f1d0b14ull,
+    0xaf8e5410288e1b6full, 0x07ecf0ae5ee44dd9ull,
+    0xdb71e91432b1a24aull, 0xc9e82cd9f69d6150ull,
+    0x892731ac9faf056eull, 0xbe311c083a225cd2ull,
+    0xab70fe17c79ac6caull, 0x6dbd630a48aaf406ull,
+    0xd64d3d9db981787dull, 0x092cbbccdad5b108ull,
+    0x85f0468293f0eb4eull, 0x25bbf56008c58ea5ull,
+    0xa76c582338ed2621ull, 0xaf2af2b80af6f24eull,
+    0xd1476e2c07286faaull, 0x1af5af660db4aee1ull,
+    0x82cca4db847945caull, 0x50d98d9fc890ed4dull,
+    0xa37fce126597973cull, 0xe50ff107bab528a0ull,
+    0xcc5fc196fefd7d0cull, 0x1e53ed49a96272c8ull,
+    0xff77b1fcbebcdc4full, 0x25e8e89c13bb0f7aull,
+    0x9faacf3df73609b1ull, 0x77b191618c54e9acull,
+    0xc795830d75038c1dull, 0xd59df5b9ef6a2417ull,
+    0xf97ae3d0d2446f25ull, 0x4b0573286b44ad1dull,
+    0x9becce62836ac577ull, 0x4ee367f9430aec32ull,
+    0xc2e801fb244576d5ull, 0x229c41f793cda73full,
+    0xf3a20279ed56d48aull, 0x6b43527578c1110full,
+    0x9845418c345644d6ull, 0x830a13896b78aaa9ull,
+    0xbe5691ef416bd60cull, 0x23cc986bc656d553ull,
+    0xedec366b11c6cb8full, 0x2cbfbe86b7ec8aa8ull,
+    0x94b3a202eb1c3f39ull, 0x7bf7d71432f3d6a9ull,
+    0xb9e08a83a5e34f07ull, 0xdaf5ccd93fb0cc53ull,
+    0xe858ad248f5c22c9ull, 0xd1b3400f8f9cff68ull,
+    0x91376c36d99995beull, 0x23100809b9c21fa1ull,
+    0xb58547448ffffb2dull, 0xabd40a0c2832a78aull,
+    0xe2e69915b3fff9f9ull, 0x16c90c8f323f516cull,
+    0x8dd01fad907ffc3bull, 0xae3da7d97f6792e3ull,
+    0xb1442798f49ffb4aull, 0x99cd11cfdf41779cull,
+    0xdd95317f31c7fa1dull, 0x40405643d711d583ull,
+    0x8a7d3eef7f1cfc52ull, 0x482835ea666b2572ull,
+    0xad1c8eab5ee43b66ull, 0xda3243650005eecfull,
+    0xd863b256369d4a40ull, 0x90bed43e40076a82ull,
+    0x873e4f75e2224e68ull, 0x5a7744a6e804a291ull,
+    0xa90de3535aaae202ull, 0x711515d0a205cb36ull,
+    0xd3515c2831559a83ull, 0x0d5a5b44ca873e03ull,
+    0x8412d9991ed58091ull, 0xe858790afe9486c2ull,
+    0xa5178fff668ae0b6ull, 0x626e974dbe39a872ull,
+    0xce5d73ff402d98e3ull, 0xfb0a3d212dc8128full,
+    0x80fa687f881c7f8eull, 0x7ce66634bc9d0b99ull,
+    0xa139029f6a239f72ull, 0x1c1fffc1ebc44e80ull,
+    0xc987434744ac874eull, 0xa327ffb266b56220ull,
+    0xfbe9141915d7a922ull, 0x4bf1ff9f0062baa8ull,
+    0x9d71ac8fada6c9b5ull, 0x6f773fc3603db4a9ull,
+    0xc4ce17b399107c22ull, 0xcb550fb4384d21d3ull,
+    0xf6019da07f549b2bull, 0x7e2a53a146606a48ull,
+    0x99c102844f94e0fbull, 0x2eda7444cbfc426dull,
+    0xc0314325637a1939ull, 0xfa911155fefb5308ull,
+    0xf03d93eebc589f88ull, 0x793555ab7eba27caull,
+    0x96267c7535b763b5ull, 0x4bc1558b2f3458deull,
+    0xbbb01b9283253ca2ull, 0x9eb1aaedfb016f16ull,
+    0xea9c227723ee8bcbull, 0x465e15a979c1cadcull,
+    0x92a1958a7675175full, 0x0bfacd89ec191ec9ull,
+    0xb749faed14125d36ull, 0xcef980ec671f667bull,
+    0xe51c79a85916f484ull, 0x82b7e12780e7401aull,
+    0x8f31cc0937ae58d2ull, 0xd1b2ecb8b0908810ull,
+    0xb2fe3f0b8599ef07ull, 0x861fa7e6dcb4aa15ull,
+    0xdfbdcece67006ac9ull, 0x67a791e093e1d49aull,
+    0x8bd6a141006042bdull, 0xe0c8bb2c5c6d24e0ull,
+    0xaecc49914078536dull, 0x58fae9f773886e18ull,
+    0xda7f5bf590966848ull, 0xaf39a475506a899eull,
+    0x888f99797a5e012dull, 0x6d8406c952429603ull,
+    0xaab37fd7d8f58178ull, 0xc8e5087ba6d33b83ull,
+    0xd5605fcdcf32e1d6ull, 0xfb1e4a9a90880a64ull,
+    0x855c3be0a17fcd26ull, 0x5cf2eea09a55067full,
+    0xa6b34ad8c9dfc06full, 0xf42faa48c0ea481eull,
+    0xd0601d8efc57b08bull, 0xf13b94daf124da26ull,
+    0x823c12795db6ce57ull, 0x76c53d08d6b70858ull,
+    0xa2cb1717b52481edull, 0x54768c4b0c64ca6eull,
+    0xcb7ddcdda26da268ull, 0xa9942f5dcf7dfd09ull,
+    0xfe5d54150b090b02ull, 0xd3f93b35435d7c4cull,
+    0x9efa548d26e5a6e1ull, 0xc47bc5014a1a6dafull,
+    0xc6b8e9b0709f109aull, 0x359ab6419ca1091bull,
+    0xf867241c8cc6d4c0ull, 0xc30163d203c94b62ull,
+    0x9b407691d7fc44f8ull, 0x79e0de63425dcf1dull,
+    0xc21094364dfb5636ull, 0x985915fc12f542e4ull,
+    0xf294b943e17a2bc4ull, 0x3e6f5b7b17b2939dull,
+    0x979cf3ca6cec5b5aull, 0xa705992ceecf9c42ull,
+    0xbd8430bd08277231ull, 0x50c6ff782a838353ull,
+    0xece53cec4a314ebdull, 0xa4f8bf5635246428ull,
+    0x940f4613ae5ed136ull, 0x871b7795e136be99ull,
+    0xb913179899f68584ull, 0x28e2557b59846e3full,
+    0xe757dd7ec07426e5ull, 0x331aeada2fe589cfull,
+    0x9096ea6f3848984full, 0x3ff0d2c85def7621ull,
+    0xb4bca50b065abe63ull, 0x0fed077a756b53a9ull,
+    0xe1ebce4dc7f16dfbull, 0xd3e8495912c62894ull,
+    0x8d3360f09cf6e4bdull, 0x64712dd7abbbd95cull,
+    0xb080392cc4349decull, 0xbd8d794d96aacfb3ull,
+    0xdca04777f541c567ull, 0xecf0d7a0fc5583a0ull,
+    0x89e42caaf9491b60ull, 0xf41686c49db57244ull,
+    0xac5d37d5b79b6239ull, 0x311c2875c522ced5ull,
+    0xd77485cb25823ac7ull, 0x7d633293366b828bull,
+    0x86a8d39ef77164bcull, 0xae5dff9c02033197ull,
+    0xa8530886b54dbdebull, 0xd9f57f830283fdfcull,
+    0xd267caa862a12d66ull, 0xd072df63c324fd7bull,
+    0x8380dea93da4bc60ull, 0x4247cb9e59f71e6dull,
+    0xa46116538d0deb78ull, 0x52d9be85f074e608ull,
+    0xcd795be870516656ull, 0x67902e276c921f8bull,
+    0x806bd9714632dff6ull, 0x00ba1cd8a3db53b6ull,
+    0xa086cfcd97bf97f3ull, 0x80e8a40eccd228a4ull,
+    0xc8a883c0fdaf7df0ull, 0x6122cd128006b2cdull,
+    0xfad2a4b13d1b5d6cull, 0x796b805720085f81ull,
+    0x9cc3a6eec6311a63ull, 0xcbe3303674053bb0ull,
+    0xc3f490aa77bd60fcull, 0xbedbfc4411068a9cull,
+    0xf4f1b4d515acb93bull, 0xee92fb5515482d44ull,
+    0x991711052d8bf3c5ull, 0x751bdd152d4d1c4aull,
+    0xbf5cd54678eef0b6ull, 0xd262d45a78a0635dull,
+    0xef340a98172aace4ull, 0x86fb897116c87c34ull,
+    0x9580869f0e7aac0eull, 0xd45d35e6ae3d4da0ull,
+    0xbae0a846d2195712ull, 0x8974836059cca109ull,
+    0xe998d258869facd7ull, 0x2bd1a438703fc94bull,
+    0x91ff83775423cc06ull, 0x7b6306a34627ddcfull,
+    0xb67f6455292cbf08ull, 0x1a3bc84c17b1d542ull,
+    0xe41f3d6a7377eecaull, 0x20caba5f1d9e4a93ull,
+    0x8e938662882af53eull, 0x547eb47b7282ee9cull,
+    0xb23867fb2a35b28dull, 0xe99e619a4f23aa43ull,
+    0xdec681f9f4c31f31ull, 0x6405fa00e2ec94d4ull,
+    0x8b3c113c38f9f37eull, 0xde83bc408dd3dd04ull,
+    0xae0b158b4738705eull, 0x9624ab50b148d445ull,
+    0xd98ddaee19068c76ull, 0x3badd624dd9b0957ull,
+    0x87f8a8d4cfa417c9ull, 0xe54ca5d70a80e5d6ull,
+    0xa9f6d30a038d1dbcull, 0x5e9fcf4ccd211f4cull,
+    0xd47487cc8470652bull, 0x7647c3200069671full,
+    0x84c8d4dfd2c63f3bull, 0x29ecd9f40041e073ull,
+    0xa5fb0a17c777cf09ull, 0xf468107100525890ull,
+    0xcf79cc9db955c2ccull, 0x7182148d4066eeb4ull,
+    0x81ac1fe293d599bfull, 0xc6f14cd848405530ull,
+    0xa21727db38cb002full, 0xb8ada00e5a506a7cull,
+    0xca9cf1d206fdc03bull, 0xa6d90811f0e4851cull,
+    0xfd442e4688bd304aull, 0x908f4a166d1da663ull,
+    0x9e4a9cec15763e2eull, 0x9a598e4e043287feull,
+    0xc5dd44271ad3cdbaull, 0x40eff1e1853f29fdull,
+    0xf7549530e188c128ull, 0xd12bee59e68ef47cull,
+    0x9a94dd3e8cf578b9ull, 0x82bb74f8301958ceull,
+    0xc13a148e3032d6e7ull, 0xe36a52363c1faf01ull,
+    0xf18899b1bc3f8ca1ull, 0xdc44e6c3cb279ac1ull,
+    0x96f5600f15a7b7e5ull, 0x29ab103a5ef8c0b9ull,
+    0xbcb2b812db11a5deull, 0x7415d448f6b6f0e7ull,
+    0xebdf661791d60f56ull, 0x111b495b3464ad21ull,
+    0x936b9fcebb25c995ull, 0xcab10dd900beec34ull,
+    0xb84687c269ef3bfbull, 0x3d5d514f40eea742ull,
+    0xe65829b3046b0afaull, 0x0cb4a5a3112a5112ull,
+    0x8ff71a0fe2c2e6dcull, 0x47f0e785eaba72abull,
+    0xb3f4e093db73a093ull, 0x59ed216765690f56ull,
+    0xe0f218b8d25088b8ull, 0x306869c13ec3532cull,
+    0x8c974f7383725573ull, 0x1e414218c73a13fbull,
+    0xafbd2350644eeacfull, 0xe5d1929ef90898faull,
+    0xdbac6c247d62a583ull, 0xdf45f746b74abf39ull,
+    0x894bc396ce5da772ull, 0x6b8bba8c328eb783ull,
+    0xab9eb47c81f5114full, 0x066ea92f3f326564ull,
+    0xd686619ba27255a2ull, 0xc80a537b0efefebdull,
+    0x8613fd0145877585ull, 0xbd06742ce95f5f36ull,
+    0xa798fc4196e952e7ull, 0x2c48113823b73704ull,
+    0xd17f3b51fca3a7a0ull, 0xf75a15862ca504c5ull,
+    0x82ef85133de648c4ull, 0x9a984d73dbe722fbull,
+    0xa3ab66580d5fdaf5ull, 0xc13e60d0d2e0ebbaull,
+    0xcc963fee10b7d1b3ull, 0x318df905079926a8ull,
+    0xffbbcfe994e5c61full, 0xfdf17746497f7052ull,
+    0x9fd561f1fd0f9bd3ull, 0xfeb6ea8bedefa633ull,
+    0xc7caba6e7c5382c8ull, 0xfe64a52ee96b8fc0ull,
+    0xf9bd690a1b68637bull, 0x3dfdce7aa3c673b0ull,
+    0x9c1661a651213e2dull, 0x06bea10ca65c084eull,
+    0xc31bfa0fe5698db8ull, 0x486e494fcff30a62ull,
+    0xf3e2f893dec3f126ull, 0x5a89dba3c3efccfaull,
+    0x986ddb5c6b3a76b7ull, 0xf89629465a75e01cull,
+    0xbe89523386091465ull, 0xf6bbb397f1135823ull,
+    0xee2ba6c0678b597full, 0x746aa07ded582e2cull,
+    0x94db483840b717efull, 0xa8c2a44eb4571cdcull,
+    0xba121a4650e4ddebull, 0x92f34d62616ce413ull,
+    0xe896a0d7e51e1566ull, 0x77b020baf9c81d17ull,
+    0x915e2486ef32cd60ull, 0x0ace1474dc1d122eull,
+    0xb5b5ada8aaff80b8ull, 0x0d819992132456baull,
+    0xe3231912d5bf60e6ull, 0x10e1fff697ed6c69ull,
+    0x8df5efabc5979c8full, 0xca8d3ffa1ef463c1ull,
+    0xb1736b96b6fd83b3ull, 0xbd308ff8a6b17cb2ull,
+    0xddd0467c64bce4a0ull, 0xac7cb3f6d05ddbdeull,
+    0x8aa22c0dbef60ee4ull, 0x6bcdf07a423aa96bull,
+    0xad4ab7112eb3929dull, 0x86c16c98d2c953c6ull,
+    0xd89d64d57a607744ull, 0xe871c7bf077ba8b7ull,
+    0x87625f056c7c4a8bull, 0x11471cd764ad4972ull,
+    0xa93af6c6c79b5d2dull, 0xd598e40d3dd89bcfull,
+    0xd389b47879823479ull, 0x4aff1d108d4ec2c3ull,
+    0x843610cb4bf160cbull, 0xcedf722a585139baull,
+    0xa54394fe1eedb8feull, 0xc2974eb4ee658828ull,
+    0xce947a3da6a9273eull, 0x733d226229feea32ull,
+    0x811ccc668829b887ull, 0x0806357d5a3f525full,
+    0xa163ff802a3426a8ull, 0xca07c2dcb0cf26f7ull,
+    0xc9bcff6034c13052ull, 0xfc89b393dd02f0b5ull,
+    0xfc2c3f3841f17c67ull, 0xbbac2078d443ace2ull,
+    0x9d9ba7832936edc0ull, 0xd54b944b84aa4c0dull,
+    0xc5029163f384a931ull, 0x0a9e795e65d4df11ull,
+    0xf64335bcf065d37dull, 0x4d4617b5ff4a16d5ull,
+    0x99ea0196163fa42eull, 0x504bced1bf8e4e45ull,
+    0xc06481fb9bcf8d39ull, 0xe45ec2862f71e1d6ull,
+    0xf07da27a82c37088ull, 0x5d767327bb4e5a4cull,
+    0x964e858c91ba2655ull, 0x3a6a07f8d510f86full,
+    0xbbe226efb628afeaull, 0x890489f70a55368bull,
+    0xeadab0aba3b2dbe5ull, 0x2b45ac74ccea842eull,
+    0x92c8ae6b464fc96full, 0x3b0b8bc90012929dull,
+    0xb77ada0617e3bbcbull, 0x09ce6ebb40173744ull,
+    0xe55990879ddcaabdull, 0xcc420a6a101d0515ull,
+    0x8f57fa54c2a9eab6ull, 0x9fa946824a12232dull,
+    0xb32df8e9f3546564ull, 0x47939822dc96abf9ull,
+    0xdff9772470297ebdull, 0x59787e2b93bc56f7ull,
+    0x8bfbea76c619ef36ull, 0x57eb4edb3c55b65aull,
+    0xaefae51477a06b03ull, 0xede622920b6b23f1ull,
+    0xdab99e59958885c4ull, 0xe95fab368e45ecedull,
+    0x88b402f7fd75539bull, 0x11dbcb0218ebb414ull,
+    0xaae103b5fcd2a881ull, 0xd652bdc29f26a119ull,
+    0xd59944a37c0752a2ull, 0x4be76d3346f0495full,
+    0x857fcae62d8493a5ull, 0x6f70a4400c562ddbull,
+    0xa6dfbd9fb8e5b88eull, 0xcb4ccd500f6bb952ull,
+    0xd097ad07a71f26b2ull, 0x7e2000a41346a7a7ull,
+    0x825ecc24c873782full, 0x8ed400668c0c28c8ull,
+    0xa2f67f2dfa90563bull, 0x728900802f0f32faull,
+    0xcbb41ef979346bcaull, 0x4f2b40a03ad2ffb9ull,
+    0xfea126b7d78186bcull, 0xe2f610c84987bfa8ull,
+    0x9f24b832e6b0f436ull, 0x0dd9ca7d2df4d7c9ull,
+    0xc6ede63fa05d3143ull, 0x91503d1c79720dbbull,
+    0xf8a95fcf88747d94ull, 0x75a44c6397ce912aull,
+    0x9b69dbe1b548ce7cull, 0xc986afbe3ee11abaull,
+    0xc24452da229b021bull, 0xfbe85badce996168ull,
+    0xf2d56790ab41c2a2ull, 0xfae27299423fb9c3ull,
+    0x97c560ba6b0919a5ull, 0xdccd879fc967d41aull,
+    0xbdb6b8e905cb600full, 0x5400e987bbc1c920ull,
+    0xed246723473e3813ull, 0x290123e9aab23b68ull,
+    0x9436c0760c86e30bull, 0xf9a0b6720aaf6521ull,
+    0xb94470938fa89bceull, 0xf808e40e8d5b3e69ull,
+    0xe7958cb87392c2c2ull, 0xb60b1d1230b20e04ull,
+    0x90bd77f3483bb9b9ull, 0xb1c6f22b5e6f48c2ull,
+    0xb4ecd5f01a4aa828ull, 0x1e38aeb6360b1af3ull,
+    0xe2280b6c20dd5232ull, 0x25c6da63c38de1b0ull,
+    0x8d590723948a535full, 0x579c487e5a38ad0eull,
+    0xb0af48ec79ace837ull, 0x2d835a9df0c6d851ull,
+    0xdcdb1b2798182244ull, 0xf8e431456cf88e65ull,
+    0x8a08f0f8bf0f156bull, 0x1b8e9ecb641b58ffull,
+    0xac8b2d36eed2dac5ull, 0xe272467e3d222f3full,
+    0xd7adf884aa879177ull, 0x5b0ed81dcc6abb0full,
+    0x86ccbb52ea94baeaull, 0x98e947129fc2b4e9ull,
+    0xa87fea27a539e9a5ull, 0x3f2398d747b36224ull,
+    0xd29fe4b18e88640eull, 0x8eec7f0d19a03aadull,
+    0x83a3eeeef9153e89ull, 0x1953cf68300424acull,
+    0xa48ceaaab75a8e2bull, 0x5fa8c3423c052dd7ull,
+    0xcdb02555653131b6ull, 0x3792f412cb06794dull,
+    0x808e17555f3ebf11ull, 0xe2bbd88bbee40bd0ull,
+    0xa0b19d2ab70e6ed6ull, 0x5b6aceaeae9d0ec4ull,
+    0xc8de047564d20a8bull, 0xf245825a5a445275ull,
+    0xfb158592be068d2eull, 0xeed6e2f0f0d56712ull,
+    0x9ced737bb6c4183dull, 0x55464dd69685606bull,
+    0xc428d05aa4751e4cull, 0xaa97e14c3c26b886ull,
+    0xf53304714d9265dfull, 0xd53dd99f4b3066a8ull,
+    0x993fe2c6d07b7fabull, 0xe546a8038efe4029ull,
+    0xbf8fdb78849a5f96ull, 0xde98520472bdd033ull,
+    0xef73d256a5c0f77cull, 0x963e66858f6d4440ull,
+    0x95a8637627989aadull, 0xdde7001379a44aa8ull,
+    0xbb127c53b17ec159ull, 0x5560c018580d5d52ull,
+    0xe9d71b689dde71afull, 0xaab8f01e6e10b4a6ull,
+    0x9226712162ab070dull, 0xcab3961304ca70e8ull,
+    0xb6b00d69bb55c8d1ull, 0x3d607b97c5fd0d22ull,
+    0xe45c10c42a2b3b05ull, 0x8cb89a7db77c506aull,
+    0x8eb98a7a9a5b04e3ull, 0x77f3608e92adb242ull,
+    0xb267ed1940f1c61cull, 0x55f038b237591ed3ull,
+    0xdf01e85f912e37a3ull, 0x6b6c46dec52f6688ull,
+    0x8b61313bbabce2c6ull, 0x2323ac4b3b3da015ull,
+    0xae397d8aa96c1b77ull, 0xabec975e0a0d081aull,
+    0xd9c7dced53c72255ull, 0x96e7bd358c904a21ull,
+    0x881cea14545c7575ull, 0x7e50d64177da2e54ull,
+    0xaa242499697392d2ull, 0xdde50bd1d5d0b9e9ull,
+    0xd4ad2dbfc3d07787ull, 0x955e4ec64b44e864ull,
+    0x84ec3c97da624ab4ull, 0xbd5af13bef0b113eull,
+    0xa6274bbdd0fadd61ull, 0xecb1ad8aeacdd58eull,
+    0xcfb11ead453994baull, 0x67de18eda5814af2ull,
+    0x81ceb32c4b43fcf4ull, 0x80eacf948770ced7ull,
+    0xa2425ff75e14fc31ull, 0xa1258379a94d028dull,
+    0xcad2f7f5359a3b3eull, 0x096ee45813a04330ull,
+    0xfd87b5f28300ca0dull, 0x8bca9d6e188853fcull,
+    0x9e74d1b791e07e48ull, 0x775ea264cf55347eull,
+    0xc612062576589ddaull, 0x95364afe032a819eull,
+    0xf79687aed3eec551ull, 0x3a83ddbd83f52205ull,
+    0x9abe14cd44753b52ull, 0xc4926a9672793543ull,
+    0xc16d9a0095928a27ull, 0x75b7053c0f178294ull,
+    0xf1c90080baf72cb1ull, 0x5324c68b12dd6339ull,
+    0x971da05074da7beeull, 0xd3f6fc16ebca5e04ull,
+    0xbce5086492111aeaull, 0x88f4bb1ca6bcf585ull,
+    0xec1e4a7db69561a5ull, 0x2b31e9e3d06c32e6ull,
+    0x9392ee8e921d5d07ull, 0x3aff322e62439fd0ull,
+    0xb877aa3236a4b449ull, 0x09befeb9fad487c3ull,
+    0xe69594bec44de15bull, 0x4c2ebe687989a9b4ull,
+    0x901d7cf73ab0acd9ull, 0x0f9d37014bf60a11ull,
+    0xb424dc35095cd80full, 0x538484c19ef38c95ull,
+    0xe12e13424bb40e13ull, 0x2865a5f206b06fbaull,
+    0x8cbccc096f5088cbull, 0xf93f87b7442e45d4ull,
+    0xafebff0bcb24aafeull, 0xf78f69a51539d749ull,
+    0xdbe6fecebdedd5beull, 0xb573440e5a884d1cull,
+    0x89705f4136b4a597ull, 0x31680a88f8953031ull,
+    0xabcc77118461cefcull, 0xfdc20d2b36ba7c3eull,
+    0xd6bf94d5e57a42bcull, 0x3d32907604691b4dull,
+    0x8637bd05af6c69b5ull, 0xa63f9a49c2c1b110ull,
+    0xa7c5ac471b478423ull, 0x0fcf80dc33721d54ull,
+    0xd1b71758e219652bull, 0xd3c36113404ea4a9ull,
+    0x83126e978d4fdf3bull, 0x645a1cac083126eaull,
+    0xa3d70a3d70a3d70aull, 0x3d70a3d70a3d70a4ull,
+    0xccccccccccccccccull, 0xcccccccccccccccdull,
+    0x8000000000000000ull, 0x0000000000000000ull,
+    0xa000000000000000ull, 0x0000000000000000ull,
+    0xc800000000000000ull, 0x0000000000000000ull,
+    0xfa00000000000000ull, 0x0000000000000000ull,
+    0x9c40000000000000ull, 0x0000000000000000ull,
+    0xc350000000000000ull, 0x0000000000000000ull,
+    0xf424000000000000ull, 0x0000000000000000ull,
+    0x9896800000000000ull, 0x0000000000000000ull,
+    0xbebc200000000000ull, 0x0000000000000000ull,
+    0xee6b280000000000ull, 0x0000000000000000ull,
+    0x9502f90000000000ull, 0x0000000000000000ull,
+    0xba43b74000000000ull, 0x0000000000000000ull,
+    0xe8d4a51000000000ull, 0x0000000000000000ull,
+    0x9184e72a00000000ull, 0x0000000000000000ull,
+    0xb5e620f480000000ull, 0x0000000000000000ull,
+    0xe35fa931a0000000ull, 0x0000000000000000ull,
+    0x8e1bc9bf04000000ull, 0x0000000000000000ull,
+    0xb1a2bc2ec5000000ull, 0x0000000000000000ull,
+    0xde0b6b3a76400000ull, 0x0000000000000000ull,
+    0x8ac7230489e80000ull, 0x0000000000000000ull,
+    0xad78ebc5ac620000ull, 0x0000000000000000ull,
+    0xd8d726b7177a8000ull, 0x0000000000000000ull,
+    0x878678326eac9000ull, 0x0000000000000000ull,
+    0xa968163f0a57b400ull, 0x0000000000000000ull,
+    0xd3c21bcecceda100ull, 0x0000000000000000ull,
+    0x84595161401484a0ull, 0x0000000000000000ull,
+    0xa56fa5b99019a5c8ull, 0x0000000000000000ull,
+    0xcecb8f27f4200f3aull, 0x0000000000000000ull,
+    0x813f3978f8940984ull, 0x4000000000000000ull,
+    0xa18f07d736b90be5ull, 0x5000000000000000ull,
+    0xc9f2c9cd04674edeull, 0xa400000000000000ull,
+    0xfc6f7c4045812296ull, 0x4d00000000000000ull,
+    0x9dc5ada82b70b59dull, 0xf020000000000000ull,
+    0xc5371912364ce305ull, 0x6c28000000000000ull,
+    0xf684df56c3e01bc6ull, 0xc732000000000000ull,
+    0x9a130b963a6c115cull, 0x3c7f400000000000ull,
+    0xc097ce7bc90715b3ull, 0x4b9f100000000000ull,
+    0xf0bdc21abb48db20ull, 0x1e86d40000000000ull,
+    0x96769950b50d88f4ull, 0x1314448000000000ull,
+    0xbc143fa4e250eb31ull, 0x17d955a000000000ull,
+    0xeb194f8e1ae525fdull, 0x5dcfab0800000000ull,
+    0x92efd1b8d0cf37beull, 0x5aa1cae500000000ull,
+    0xb7abc627050305adull, 0xf14a3d9e40000000ull,
+    0xe596b7b0c643c719ull, 0x6d9ccd05d0000000ull,
+    0x8f7e32ce7bea5c6full, 0xe4820023a2000000ull,
+    0xb35dbf821ae4f38bull, 0xdda2802c8a800000ull,
+    0xe0352f62a19e306eull, 0xd50b2037ad200000ull,
+    0x8c213d9da502de45ull, 0x4526f422cc340000ull,
+    0xaf298d050e4395d6ull, 0x9670b12b7f410000ull,
+    0xdaf3f04651d47b4cull, 0x3c0cdd765f114000ull,
+    0x88d8762bf324cd0full, 0xa5880a69fb6ac800ull,
+    0xab0e93b6efee0053ull, 0x8eea0d047a457a00ull,
+    0xd5d238a4abe98068ull, 0x72a4904598d6d880ull,
+    0x85a36366eb71f041ull, 0x47a6da2b7f864750ull,
+    0xa70c3c40a64e6c51ull, 0x999090b65f67d924ull,
+    0xd0cf4b50cfe20765ull, 0xfff4b4e3f741cf6dull,
+    0x82818f1281ed449full, 0xbff8f10e7a8921a4ull,
+    0xa321f2d7226895c7ull, 0xaff72d52192b6a0dull,
+    0xcbea6f8ceb02bb39ull, 0x9bf4f8a69f764490ull,
+    0xfee50b7025c36a08ull, 0x02f236d04753d5b4ull,
+    0x9f4f2726179a2245ull, 0x01d762422c946590ull,
+    0xc722f0ef9d80aad6ull, 0x424d3ad2b7b97ef5ull,
+    0xf8ebad2b84e0d58bull, 0xd2e0898765a7deb2ull,
+    0x9b934c3b330c8577ull, 0x63cc55f49f88eb2full,
+    0xc2781f49ffcfa6d5ull, 0x3cbf6b71c76b25fbull,
+    0xf316271c7fc3908aull, 0x8bef464e3945ef7aull,
+    0x97edd871cfda3a56ull, 0x97758bf0e3cbb5acull,
+    0xbde94e8e43d0c8ecull, 0x3d52eeed1cbea317ull,
+    0xed63a231d4c4fb27ull, 0x4ca7aaa863ee4bddull,
+    0x945e455f24fb1cf8ull, 0x8fe8caa93e74ef6aull,
+    0xb975d6b6ee39e436ull, 0xb3e2fd538e122b44ull,
+    0xe7d34c64a9c85d44ull, 0x60dbbca87196b616ull,
+    0x90e40fbeea1d3a4aull, 0xbc8955e946fe31cdull,
+    0xb51d13aea4a488ddull, 0x6babab6398bdbe41ull,
+    0xe264589a4dcdab14ull, 0xc696963c7eed2dd1ull,
+    0x8d7eb76070a08aecull, 0xfc1e1de5cf543ca2ull,
+    0xb0de65388cc8ada8ull, 0x3b25a55f43294bcbull,
+    0xdd15fe86affad912ull, 0x49ef0eb713f39ebeull,
+    0x8a2dbf142dfcc7abull, 0x6e3569326c784337ull,
+    0xacb92ed9397bf996ull, 0x49c2c37f07965404ull,
+    0xd7e77a8f87daf7fbull, 0xdc33745ec97be906ull,
+    0x86f0ac99b4e8dafdull, 0x69a028bb3ded71a3ull,
+    0xa8acd7c0222311bcull, 0xc40832ea0d68ce0cull,
+    0xd2d80db02aabd62bull, 0xf50a3fa490c30190ull,
+    0x83c7088e1aab65dbull, 0x792667c6da79e0faull,
+    0xa4b8cab1a1563f52ull, 0x577001b891185938ull,
+    0xcde6fd5e09abcf26ull, 0xed4c0226b55e6f86ull,
+    0x80b05e5ac60b6178ull, 0x544f8158315b05b4ull,
+    0xa0dc75f1778e39d6ull, 0x696361ae3db1c721ull,
+    0xc913936dd571c84cull, 0x03bc3a19cd1e38e9ull,
+    0xfb5878494ace3a5full, 0x04ab48a04065c723ull,
+    0x9d174b2dcec0e47bull, 0x62eb0d64283f9c76ull,
+    0xc45d1df942711d9aull, 0x3ba5d0bd324f8394ull,
+    0xf5746577930d6500ull, 0xca8f44ec7ee36479ull,
+    0x9968bf6abbe85f20ull, 0x7e998b13cf4e1ecbull,
+    0xbfc2ef456ae276e8ull, 0x9e3fedd8c321a67eull,
+    0xefb3ab16c59b14a2ull, 0xc5cfe94ef3ea101eull,
+    0x95d04aee3b80ece5ull, 0xbba1f1d158724a12ull,
+    0xbb445da9ca61281full, 0x2a8a6e45ae8edc97ull,
+    0xea1575143cf97226ull, 0xf52d09d71a3293bdull,
+    0x924d692ca61be758ull, 0x593c2626705f9c56ull,
+    0xb6e0c377cfa2e12eull, 0x6f8b2fb00c77836cull,
+    0xe498f455c38b997aull, 0x0b6dfb9c0f956447ull,
+    0x8edf98b59a373fecull, 0x4724bd4189bd5eacull,
+    0xb2977ee300c50fe7ull, 0x58edec91ec2cb657ull,
+    0xdf3d5e9bc0f653e1ull, 0x2f2967b66737e3edull,
+    0x8b865b215899f46cull, 0xbd79e0d20082ee74ull,
+    0xae67f1e9aec07187ull, 0xecd8590680a3aa11ull,
+    0xda01ee641a708de9ull, 0xe80e6f4820cc9495ull,
+    0x884134fe908658b2ull, 0x3109058d147fdcddull,
+    0xaa51823e34a7eedeull, 0xbd4b46f0599fd415ull,
+    0xd4e5e2cdc1d1ea96ull, 0x6c9e18ac7007c91aull,
+    0x850fadc09923329eull, 0x03e2cf6bc604ddb0ull,
+    0xa6539930bf6bff45ull, 0x84db8346b786151cull,
+    0xcfe87f7cef46ff16ull, 0xe612641865679a63ull,
+    0x81f14fae158c5f6eull, 0x4fcb7e8f3f60c07eull,
+    0xa26da3999aef7749ull, 0xe3be5e330f38f09dull,
+    0xcb090c8001ab551cull, 0x5cadf5bfd3072cc5ull,
+    0xfdcb4fa002162a63ull, 0x73d9732fc7c8f7f6ull,
+    0x9e9f11c4014dda7eull, 0x2867e7fddcdd9afaull,
+    0xc646d63501a1511dull, 0xb281e1fd541501b8ull,
+    0xf7d88bc24209a565ull, 0x1f225a7ca91a4226ull,
+    0x9ae757596946075full, 0x3375788de9b06958ull,
+    0xc1a12d2fc3978937ull, 0x0052d6b1641c83aeull,
+    0xf209787bb47d6b84ull, 0xc0678c5dbd23a49aull,
+    0x9745eb4d50ce6332ull, 0xf840b7ba963646e0ull,
+    0xbd176620a501fbffull, 0xb650e5a93bc3d898ull,
+    0xec5d3fa8ce427affull, 0xa3e51f138ab4cebeull,
+    0x93ba47c980e98cdfull, 0xc66f336c36b10137ull,
+    0xb8a8d9bbe123f017ull, 0xb80b0047445d4184ull,
+    0xe6d3102ad96cec1dull, 0xa60dc059157491e5ull,
+    0x9043ea1ac7e41392ull, 0x87c89837ad68db2full,
+    0xb454e4a179dd1877ull, 0x29babe4598c311fbull,
+    0xe16a1dc9d8545e94ull, 0xf4296dd6fef3d67aull,
+    0x8ce2529e2734bb1dull, 0x1899e4a65f58660cull,
+    0xb01ae745b101e9e4ull, 0x5ec05dcff72e7f8full,
+    0xdc21a1171d42645dull, 0x76707543f4fa1f73ull,
+    0x899504ae72497ebaull, 0x6a06494a791c53a8ull,
+    0xabfa45da0edbde69ull, 0x0487db9d17636892ull,
+    0xd6f8d7509292d603ull, 0x45a9d2845d3c42b6ull,
+    0x865b86925b9bc5c2ull, 0x0b8a2392ba45a9b2ull,
+    0xa7f26836f282b732ull, 0x8e6cac7768d7141eull,
+    0xd1ef0244af2364ffull, 0x3207d795430cd926ull,
+    0x8335616aed761f1full, 0x7f44e6bd49e807b8ull,
+    0xa402b9c5a8d3a6e7ull, 0x5f16206c9c6209a6ull,
+    0xcd036837130890a1ull, 0x36dba887c37a8c0full,
+    0x802221226be55a64ull, 0xc2494954da2c9789ull,
+    0xa02aa96b06deb0fdull, 0xf2db9baa10b7bd6cull,
+    0xc83553c5c8965d3dull, 0x6f92829494e5acc7ull,
+    0xfa42a8b73abbf48cull, 0xcb772339ba1f17f9ull,
+    0x9c69a97284b578d7ull, 0xff2a760414536efbull,
+    0xc38413cf25e2d70dull, 0xfef5138519684abaull,
+    0xf46518c2ef5b8cd1ull, 0x7eb258665fc25d69ull,
+    0x98bf2f79d5993802ull, 0xef2f773ffbd97a61ull,
+    0xbeeefb584aff8603ull, 0xaafb550ffacfd8faull,
+    0xeeaaba2e5dbf6784ull, 0x95ba2a53f983cf38ull,
+    0x952ab45cfa97a0b2ull, 0xdd945a747bf26183ull,
+    0xba756174393d88dfull, 0x94f971119aeef9e4ull,
+    0xe912b9d1478ceb17ull, 0x7a37cd5601aab85dull,
+    0x91abb422ccb812eeull, 0xac62e055c10ab33aull,
+    0xb616a12b7fe617aaull, 0x577b986b314d6009ull,
+    0xe39c49765fdf9d94ull, 0xed5a7e85fda0b80bull,
+    0x8e41ade9fbebc27dull, 0x14588f13be847307ull,
+    0xb1d219647ae6b31cull, 0x596eb2d8ae258fc8ull,
+    0xde469fbd99a05fe3ull, 0x6fca5f8ed9aef3bbull,
+    0x8aec23d680043beeull, 0x25de7bb9480d5854ull,
+    0xada72ccc20054ae9ull, 0xaf561aa79a10ae6aull,
+    0xd910f7ff28069da4ull, 0x1b2ba1518094da04ull,
+    0x87aa9aff79042286ull, 0x90fb44d2f05d0842ull,
+    0xa99541bf57452b28ull, 0x353a1607ac744a53ull,
+    0xd3fa922f2d1675f2ull, 0x42889b8997915ce8ull,
+    0x847c9b5d7c2e09b7ull, 0x69956135febada11ull,
+    0xa59bc234db398c25ull, 0x43fab9837e699095ull,
+    0xcf02b2c21207ef2eull, 0x94f967e45e03f4bbull,
+    0x8161afb94b44f57dull, 0x1d1be0eebac278f5ull,
+    0xa1ba1ba79e1632dcull, 0x6462d92a69731732ull,
+    0xca28a291859bbf93ull, 0x7d7b8f7503cfdcfeull,
+    0xfcb2cb35e702af78ull, 0x5cda735244c3d43eull,
+    0x9defbf01b061adabull, 0x3a0888136afa64a7ull,
+    0xc56baec21c7a1916ull, 0x088aaa1845b8fdd0ull,
+    0xf6c69a72a3989f5bull, 0x8aad549e57273d45ull,
+    0x9a3c2087a63f6399ull, 0x36ac54e2f678864bull,
+    0xc0cb28a98fcf3c7full, 0x84576a1bb416a7ddull,
+    0xf0fdf2d3f3c30b9full, 0x656d44a2a11c51d5ull,
+    0x969eb7c47859e743ull, 0x9f644ae5a4b1b325ull,
+    0xbc4665b596706114ull, 0x873d5d9f0dde1feeull,
+    0xeb57ff22fc0c7959ull, 0xa90cb506d155a7eaull,
+    0x9316ff75dd87cbd8ull, 0x09a7f12442d588f2ull,
+    0xb7dcbf5354e9beceull, 0x0c11ed6d538aeb2full,
+    0xe5d3ef282a242e81ull, 0x8f1668c8a86da5faull,
+    0x8fa475791a569d10ull, 0xf96e017d694487bcull,
+    0xb38d92d760ec4455ull, 0x37c981dcc395a9acull,
+    0xe070f78d3927556aull, 0x85bbe253f47b1417ull,
+    0x8c469ab843b89562ull, 0x93956d7478ccec8eull,
+    0xaf58416654a6babbull, 0x387ac8d1970027b2ull,
+    0xdb2e51bfe9d0696aull, 0x06997b05fcc0319eull,
+    0x88fcf317f22241e2ull, 0x441fece3bdf81f03ull,
+    0xab3c2fddeeaad25aull, 0xd527e81cad7626c3ull,
+    0xd60b3bd56a5586f1ull, 0x8a71e223d8d3b074ull,
+    0x85c7056562757456ull, 0xf6872d5667844e49ull,
+    0xa738c6bebb12d16cull, 0xb428f8ac016561dbull,
+    0xd106f86e69d785c7ull, 0xe13336d701beba52ull,
+    0x82a45b450226b39cull, 0xecc0024661173473ull,
+    0xa34d721642b06084ull, 0x27f002d7f95d0190ull,
+    0xcc20ce9bd35c78a5ull, 0x31ec038df7b441f4ull,
+    0xff290242c83396ceull, 0x7e67047175a15271ull,
+    0x9f79a169bd203e41ull, 0x0f0062c6e984d386ull,
+    0xc75809c42c684dd1ull, 0x52c07b78a3e60868ull,
+    0xf92e0c3537826145ull, 0xa7709a56ccdf8a82ull,
+    0x9bbcc7a142b17ccbull, 0x88a66076400bb691ull,
+    0xc2abf989935ddbfeull, 0x6acff893d00ea435ull,
+    0xf356f7ebf83552feull, 0x0583f6b8c4124d43ull,
+    0x98165af37b2153deull, 0xc3727a337a8b704aull,
+    0xbe1bf1b059e9a8d6ull, 0x744f18c0592e4c5cull,
+    0xeda2ee1c7064130cull, 0x1162def06f79df73ull,
+    0x9485d4d1c63e8be7ull, 0x8addcb5645ac2ba8ull,
+    0xb9a74a0637ce2ee1ull, 0x6d953e2bd7173692ull,
+    0xe8111c87c5c1ba99ull, 0xc8fa8db6ccdd0437ull,
+    0x910ab1d4db9914a0ull, 0x1d9c9892400a22a2ull,
+    0xb54d5e4a127f59c8ull, 0x2503beb6d00cab4bull,
+    0xe2a0b5dc971f303aull, 0x2e44ae64840fd61dull,
+    0x8da471a9de737e24ull, 0x5ceaecfed289e5d2ull,
+    0xb10d8e1456105dadull, 0x7425a83e872c5f47ull,
+    0xdd50f1996b947518ull, 0xd12f124e28f77719ull,
+    0x8a5296ffe33cc92full, 0x82bd6b70d99aaa6full,
+    0xace73cbfdc0bfb7bull, 0x636cc64d1001550bull,
+    0xd8210befd30efa5aull, 0x3c47f7e05401aa4eull,
+    0x8714a775e3e95c78ull, 0x65acfaec34810a71ull,
+    0xa8d9d1535ce3b396ull, 0x7f1839a741a14d0dull,
+    0xd31045a8341ca07cull, 0x1ede48111209a050ull,
+    0x83ea2b892091e44dull, 0x934aed0aab460432ull,
+    0xa4e4b66b68b65d60ull, 0xf81da84d5617853full,
+    0xce1de40642e3f4b9ull, 0x36251260ab9d668eull,
+    0x80d2ae83e9ce78f3ull, 0xc1d72b7c6b426019ull,
+    0xa1075a24e4421730ull, 0xb24cf65b8612f81full,
+    0xc94930ae1d529cfcull, 0xdee033f26797b627ull,
+    0xfb9b7cd9a4a7443cull, 0x169840ef017da3b1ull,
+    0x9d412e0806e88aa5ull, 0x8e1f289560ee864eull,
+    0xc491798a08a2ad4eull, 0xf1a6f2bab92a27e2ull,
+    0xf5b5d7ec8acb58a2ull, 0xae10af696774b1dbull,
+    0x9991a6f3d6bf1765ull, 0xacca6da1e0a8ef29ull,
+    0xbff610b0cc6edd3full, 0x17fd090a58d32af3ull,
+    0xeff394dcff8a948eull, 0xddfc4b4cef07f5b0ull,
+    0x95f83d0a1fb69cd9ull, 0x4abdaf101564f98eull,
+    0xbb764c4ca7a4440full, 0x9d6d1ad41abe37f1ull,
+    0xea53df5fd18d5513ull, 0x84c86189216dc5edull,
+    0x92746b9be2f8552cull, 0x32fd3cf5b4e49bb4ull,
+    0xb7118682dbb66a77ull, 0x3fbc8c33221dc2a1ull,
+    0xe4d5e82392a40515ull, 0x0fabaf3feaa5334aull,
+    0x8f05b1163ba6832dull, 0x29cb4d87f2a7400eull,
+    0xb2c71d5bca9023f8ull, 0x743e20e9ef511012ull,
+    0xdf78e4b2bd342cf6ull, 0x914da9246b255416ull,
+    0x8bab8eefb6409c1aull, 0x1ad089b6c2f7548eull,
+    0xae9672aba3d0c320ull, 0xa184ac2473b529b1ull,
+    0xda3c0f568cc4f3e8ull, 0xc9e5d72d90a2741eull,
+    0x8865899617fb1871ull, 0x7e2fa67c7a658892ull,
+    0xaa7eebfb9df9de8dull, 0xddbb901b98feeab7ull,
+    0xd51ea6fa85785631ull, 0x552a74227f3ea565ull,
+    0x8533285c936b35deull, 0xd53a88958f87275full,
+    0xa67ff273b8460356ull, 0x8a892abaf368f137ull,
+    0xd01fef10a657842cull, 0x2d2b7569b0432d85ull,
+    0x8213f56a67f6b29bull, 0x9c3b29620e29fc73ull,
+    0xa298f2c501f45f42ull, 0x8349f3ba91b47b8full,
+    0xcb3f2f7642717713ull, 0x241c70a936219a73ull,
+    0xfe0efb53d30dd4d7ull, 0xed238cd383aa0110ull,
+    0x9ec95d1463e8a506ull, 0xf4363804324a40aaull,
+    0xc67bb4597ce2ce48ull, 0xb143c6053edcd0d5ull,
+    0xf81aa16fdc1b81daull, 0xdd94b7868e94050aull,
+    0x9b10a4e5e9913128ull, 0xca7cf2b4191c8326ull,
+    0xc1d4ce1f63f57d72ull, 0xfd1c2f611f63a3f0ull,
+    0xf24a01a73cf2dccfull, 0xbc633b39673c8cecull,
+    0x976e41088617ca01ull, 0xd5be0503e085d813ull,
+    0xbd49d14aa79dbc82ull, 0x4b2d8644d8a74e18ull,
+    0xec9c459d51852ba2ull, 0xddf8e7d60ed1219eull,
+    0x93e1ab8252f33b45ull, 0xcabb90e5c942b503ull,
+    0xb8da1662e7b00a17ull, 0x3d6a751f3b936243ull,
+    0xe7109bfba19c0c9dull, 0x0cc512670a783ad4ull,
+    0x906a617d450187e2ull, 0x27fb2b80668b24c5ull,
+    0xb484f9dc9641e9daull, 0xb1f9f660802dedf6ull,
+    0xe1a63853bbd26451ull, 0x5e7873f8a0396973ull,
+    0x8d07e33455637eb2ull, 0xdb0b487b6423e1e8ull,
+    0xb049dc016abc5e5full, 0x91ce1a9a3d2cda62ull,
+    0xdc5c5301c56b75f7ull, 0x7641a140cc7810fbull,
+    0x89b9b3e11b6329baull, 0xa9e904c87fcb0a9dull,
+    0xac2820d9623bf429ull, 0x546345fa9fbdcd44ull,
+    0xd732290fbacaf133ull, 0xa97c177947ad4095ull,
+    0x867f59a9d4bed6c0ull, 0x49ed8eabcccc485dull,
+    0xa81f301449ee8c70ull, 0x5c68f256bfff5a74ull,
+    0xd226fc195c6a2f8cull, 0x73832eec6fff3111ull,
+    0x83585d8fd9c25db7ull, 0xc831fd53c5ff7eabull,
+    0xa42e74f3d032f525ull, 0xba3e7ca8b77f5e55ull,
+    0xcd3a1230c43fb26full, 0x28ce1bd2e55f35ebull,
+    0x80444b5e7aa7cf85ull, 0x7980d163cf5b81b3ull,
+    0xa0555e361951c366ull, 0xd7e105bcc332621full,
+    0xc86ab5c39fa63440ull, 0x8dd9472bf3fefaa7ull,
+    0xfa856334878fc150ull, 0xb14f98f6f0feb951ull,
+    0x9c935e00d4b9d8d2ull, 0x6ed1bf9a569f33d3ull,
+    0xc3b8358109e84f07ull, 0x0a862f80ec4700c8ull,
+    0xf4a642e14c6262c8ull, 0xcd27bb612758c0faull,
+    0x98e7e9cccfbd7dbdull, 0x8038d51cb897789cull,
+    0xbf21e44003acdd2cull, 0xe0470a63e6bd56c3ull,
+    0xeeea5d5004981478ull, 0x1858ccfce06cac74ull,
+    0x95527a5202df0ccbull, 0x0f37801e0c43ebc8ull,
+    0xbaa718e68396cffdull, 0xd30560258f54e6baull,
+    0xe950df20247c83fdull, 0x47c6b82ef32a2069ull,
+    0x91d28b7416cdd27eull, 0x4cdc331d57fa5441ull,
+    0xb6472e511c81471dull, 0xe0133fe4adf8e952ull,
+    0xe3d8f9e563a198e5ull, 0x58180fddd97723a6ull,
+    0x8e679c2f5e44ff8full, 0x570f09eaa7ea7648ull
+};
+
+#if defined __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 td__u128;
+#endif
+
+internal void
+td__mul_64x64(u64 a, u64 b, u64 *hi, u64 *lo)
+{
+#if defined __SIZEOF_INT128__
+    td__u128 r = (td__u128)a * b;
+    *hi = (u64)(r >> 64);
+    *lo = (u64)r;
+#elif defined COMPILER_MS && defined ARCH_X64
+    *lo = _umul128(a, b, hi);
+#elif defined COMPILER_MS && defined ARCH_ARM64
+    *hi = __umulh(a, b);
+    *lo = a * b;
+#else
+    u64 a_lo = (u32)a, a_hi = a >> 32, b_lo = (u32)b, b_hi = b >> 32;
+    u64 ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    u64 mid = (ll >> 32) + (u32)lh + (u32)hl;
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    *lo = (mid << 32) | (u32)ll;
+#endif
+}
+
+/* The bits of one IEEE binary format Eisel-Lemire needs to know */
+typedef struct {
+    i32 mantissa_bits;
+    i32 min_exponent;
+    i32 infinite_power;
+    i32 smallest_power_of_ten, largest_power_of_ten;
+    i32 min_round_to_even, max_round_to_even;
+} TD__Float_Format;
+
+global_variable const TD__Float_Format td__f64_format = { 52, -1023, 0x7FF, -342, 308, -4, 23 };
+global_variable const TD__Float_Format td__f32_format = { 23, -127, 0xFF, -64, 38, -17, 10 };
+
+/* w * 10^q as a biased exponent and mantissa, without the hidden bit */
+internal void
+td__eisel_lemire(const TD__Float_Format *f, u64 w, i64 q, u64 *mantissa, i32 *power2)
+{
+    if (w == 0 || q < f->smallest_power_of_ten) {
+        *mantissa = 0;
+        *power2 = 0;
+        return;
+    }
+    if (q > f->largest_power_of_ten) {
+        *mantissa = 0;
+        *power2 = f->infinite_power;
+        return;
+    }
+
+    i32 lz = 63 - (i32)td__msb64(w);
+    w <<= lz;
+
+    /* Only look at the second half of the power when the first leaves the
+       bits that decide rounding all ones */
+    size_t index = 2 * (size_t)(q + 342);
+    u64 hi, lo, hi2, lo2;
+    u64 precision_mask = (u64)-1 >> (f->mantissa_bits + 3);
+
+    td__mul_64x64(w, td__pow5_128[index], &hi, &lo);
+    if ((hi & precision_mask) == precision_mask) {
+        td__mul_64x64(w, td__pow5_128[index + 1], &hi2, &lo2);
+        lo += hi2;
+        if (hi2 > lo) hi++;
+    }
+
+    i32 upperbit = (i32)(hi >> 63);
+    i32 shift = upperbit + 64 - f->mantissa_bits - 3;
+    u64 m = hi >> shift;
+    /* floor(q * log2(10)) + 63, for the q range of the table */
+    i32 p2 = ((((152170 + 65536) * (i32)q) >> 16) + 63) + upperbit - lz - f->min_exponent;
+
+    if (p2 <= 0) {
+        if (-p2 + 1 >= 64) {
+            *mantissa = 0;
+            *power2 = 0;
+            return;
+        }
+        m >>= -p2 + 1;
+        m += m & 1;
+        m >>= 1;
+        *power2 = m < ((u64)1 << f->mantissa_bits) ? 0 : 1;
+        *mantissa = m & ~((u64)1 << f->mantissa_bits);
+        return;
+    }
+
+    /* Exactly half way between two floats: round to even */
+    if (lo <= 1 && q >= f->min_round_to_even && q <= f->max_round_to_even &&
+        (m & 3) == 1 && (m << shift) == hi) {
+        m &= ~(u64)1;
+    }
+
+    m += m & 1;
+    m >>= 1;
+    if (m >= ((u64)2 << f->mantissa_bits)) {
+        m = (u64)1 << f->mantissa_bits;
+        p2++;
+    }
+    m &= ~((u64)1 << f->mantissa_bits);
+
+    if (p2 >= f->infinite_power) {
+        p2 = f->infinite_power;
+        m = 0;
+    }
+
+    *mantissa = m;
+    *power2 = p2;
+}
+
+/* What the text of a float says, before any rounding */
+typedef struct {
+    bool        negative, truncated, inf, nan;
+    u64         w;
+    i64         q;
+    size_t      length;
+} TD__Decimal;
+
+internal bool
+td__match_word(const char *p, const char *end, const char *word)
+{
+    for (; *word; p++, word++)
+        if (p >= end || (*p | 0x20) != *word) return false;
+    return true;
+}
+
+/* Sign, digits, '.', more digits, exponent. Fills d and returns false with
+   errno EINVAL if there are no digits. */
+internal bool
+td__parse_decimal(TD_String_View v, TD__Decimal *d)
+{
+    const char *p = v.data, *end = v.data + v.size;
+
+    memset(d, 0, sizeof(*d));
+    if (p < end && (*p == '+' || *p == '-')) {
+        d->negative = *p == '-';
+        p++;
+    }
+
+    if (td__match_word(p, end, "inf")) {
+        d->inf = true;
+        p += td__match_word(p, end, "infinity") ? 8 : 3;
+        d->length = (size_t)(p - v.data);
+        return true;
+    }
+    if (td__match_word(p, end, "nan")) {
+        d->nan = true;
+        d->length = (size_t)(p + 3 - v.data);
+        return true;
+    }
+
+    const char *digits = p;
+    u64 w = 0;
+    while (p < end && td__is_digit(*p)) {
+        w = w * 10 + (u64)(*p - '0');
+        p++;
+    }
+    i64 count = p - digits, frac = 0;
+
+    if (p < end && *p == '.') {
+        const char *first = ++p;
+        while (end - p >= 8 && td__is_eight_digits(td__load_le64(p))) {
+            w = w * 100000000 + td__parse_eight_digits(td__load_le64(p));
+            p += 8;
+        }
+        while (p < end && td__is_digit(*p)) {
+            w = w * 10 + (u64)(*p - '0');
+            p++;
+        }
+        frac = p - first;
+        count += frac;
+    }
+
+    if (count == 0) {
+        errno = EINVAL;
+        return false;
+    }
+    const char *digits_end = p;
+
+    /* An 'e' without digits after it isn't part of the number */
+    i64 exp = 0;
+    if (p < end && (*p | 0x20) == 'e') {
+        const char *e = p + 1;
+        bool negative = false;
+        if (e < end && (*e == '+' || *e == '-')) {
+            negative = *e == '-';
+            e++;
+        }
+        if (e < end && td__is_digit(*e)) {
+            for (; e < end && td__is_digit(*e); e++)
+                if (exp < 0x10000000) exp = exp * 10 + (*e - '0');
+            if (negative) exp = -exp;
+            p = e;
+        }
+    }
+
+    d->length = (size_t)(p - v.data);
+    d->w = w;
+    d->q = exp - frac;
+    if (count <= 19) return true;
+
+    /* More than 19 digits, so w wrapped. Leading zeros don't count; if that
+       still leaves more than 19, keep the first 19 and remember the rest
+       are cut. */
+    i64 scale = 0, taken = 0;
+    bool seen_dot = false, significant = false;
+
+    w = 0;
+    for (const char *c = digits; c < digits_end; c++) {
+        if (*c == '.') {
+            seen_dot = true;
+            continue;
+        }
+        if (!significant && *c == '0') {
+            if (seen_dot) scale--;
+            continue;
+        }
+        significant = true;
+        if (taken < 19) {
+            w = w * 10 + (u64)(*c - '0');
+            taken++;
+            if (seen_dot) scale--;
+        } else {
+            d->truncated = true;
+            if (!seen_dot) scale++;
+        }
+    }
+
+    d->w = w;
+    d->q = exp + scale;
+    return true;
+}
+
+/* Copies the number with the locale's decimal point and asks strtod */
+internal f64
+td__strtod_view(const char *p, size_t n, bool single)
+{
+    const char *point = localeconv()->decimal_point;
+    size_t point_len = strlen(point);
+    char stack[128];
+    char *buf = stack;
+    size_t k = 0;
+    f64 r;
+
+    if (n * point_len + 1 > sizeof(stack)) {
+        buf = TD_MALLOC(n * point_len + 1);
+        if (buf == NULL) {
+            TD_PANIC("TD_MALLOC: out of memory");
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] == '.') {
+            memcpy(buf + k, point, point_len);
+            k += point_len;
+        } else {
+            buf[k++] = p[i];
+        }
+    }
+    buf[k] = '\0';
+
+    r = single ? (f64)strtof(buf, NULL) : strtod(buf, NULL);
+    if (buf != stack) TD_FREE(buf);
+    return r;
+}
+
+global_variable const f64 td__pow10_f64[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+global_variable const f32 td__pow10_f32[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+};
+
+TD_LIBDEF bool
+td_string_view_parse_f64(TD_String_View *v, f64 *out)
+{
+    TD__Decimal d;
+    u64 bits, m, m2;
+    i32 p2, p22;
+    f64 r;
+
+    if (!td__parse_decimal(*v, &d)) return false;
+
+    if (d.inf || d.nan) {
+        bits = d.inf ? 0x7FF0000000000000ull : 0x7FF8000000000000ull;
+        bits |= (u64)d.negative << 63;
+        memcpy(&r, &bits, sizeof(r));
+        goto done;
+    }
+
+    /* Clinger: both w and 10^q are exact doubles, so one correctly rounded
+       multiply or divide is the answer. Not with x87 extended precision. */
+#if defined FLT_EVAL_METHOD && (FLT_EVAL_METHOD == 0 || FLT_EVAL_METHOD == 1)
+    if (!d.truncated && d.q >= -22 && d.q <= 22 && d.w <= ((u64)1 << 53)) {
+        r = (f64)d.w;
+        r = d.q < 0 ? r / td__pow10_f64[-d.q] : r * td__pow10_f64[d.q];
+        if (d.negative) r = -r;
+        goto done;
+    }
+#endif
+
+    td__eisel_lemire(&td__f64_format, d.w, d.q, &m, &p2);
+    if (d.truncated) {
+        td__eisel_lemire(&td__f64_format, d.w + 1, d.q, &m2, &p22);
+        if (m != m2 || p2 != p22) {
+            r = td__strtod_view(v->data, d.length, false);
+            goto done;
+        }
+    }
+
+    bits = m | (u64)p2 << 52 | (u64)d.negative << 63;
+    memcpy(&r, &bits, sizeof(r));
+
+done:
+    v->data += d.length;
+    v->size -= d.length;
+    *out = r;
+    return true;
+}
+
+TD_LIBDEF bool
+td_string_view_parse_f32(TD_String_View *v, f32 *out)
+{
+    TD__Decimal d;
+    u64 m, m2;
+    u32 bits;
+    i32 p2, p22;
+    f32 r;
+
+    if (!td__parse_decimal(*v, &d)) return false;
+
+    if (d.inf || d.nan) {
+        bits = d.inf ? 0x7F800000u : 0x7FC00000u;
+        bits |= (u32)d.negative << 31;
+        memcpy(&r, &bits, sizeof(r));
+        goto done;
+    }
+
+#if defined FLT_EVAL_METHOD && FLT_EVAL_METHOD == 0
+    if (!d.truncated && d.q >= -10 && d.q <= 10 && d.w <= ((u64)1 << 24)) {
+        r = (f32)d.w;
+        r = d.q < 0 ? r / td__pow10_f32[-d.q] : r * td__pow10_f32[d.q];
+        if (d.negative) r = -r;
+        goto done;
+    }
+#endif
+
+    td__eisel_lemire(&td__f32_format, d.w, d.q, &m, &p2);
+    if (d.truncated) {
+        td__eisel_lemire(&td__f32_format, d.w + 1, d.q, &m2, &p22);
+        if (m != m2 || p2 != p22) {
+            r = (f32)td__strtod_view(v->data, d.length, true);
+            goto done;
+        }
+    }
+
+    bits = (u32)m | (u32)p2 << 23 | (u32)d.negative << 31;
+    memcpy(&r, &bits, sizeof(r));
+
+done:
+    v->data += d.length;
+    v->size -= d.length;
+    *out = r;
+    return true;
+}
+
+#endif /* TDLIB_IMPLEMENTATION */
+
+#if defined TDLIB_IMPLEMENTATION && defined TDLIB_BENCH_MAIN
+
+/* The library's benchmark suite. See Benchmarks in PRIMER. */
+
+typedef struct {
+    int    *data;
+    size_t  size, alloc;
+} TD__Bench_Ints;
+
+typedef struct {
+    TD_String_View  view, other;
+    char           *buffer;
+    size_t          size;
+    FILE           *fp;
+    TD_Writer       writer;
+    TD__Bench_Ints  ints;
+} TD__Bench_Arg;
+
+internal void
+td__bench_vec_append(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        a->ints.size = 0;
+        for (size_t k = 0; k < a->size; k++) td_vec_append(&a->ints, (int)k);
+        td_do_not_optimize(a->ints.data);
+    }
+}
+
+internal void
+td__bench_vec_append_grow(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD__Bench_Ints v = {0};
+        for (size_t k = 0; k < a->size; k++) td_vec_append(&v, (int)k);
+        td_do_not_optimize(v.data);
+        TD_FREE(v.data);
+    }
+}
+
+internal void
+td__bench_vec_append_bulk(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String s = {0};
+        td_vec_append_bulk(&s, a->view.data, a->view.size);
+        td_do_not_optimize(s.data);
+        TD_FREE(s.data);
+    }
+}
+
+internal void
+td__bench_equal(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        bool eq = td_string_view_equal(a->view, a->other);
+        td_do_not_optimize(&eq);
+    }
+}
+
+internal void
+td__bench_chop(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String_View rest = a->view;
+        TD_String_View line = td_string_view_chop(&rest, '\n');
+        td_do_not_optimize(&line);
+        td_do_not_optimize(&rest);
+    }
+}
+
+internal void
+td__bench_trim(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String_View t = td_string_view_trim(a->other);
+        td_do_not_optimize(&t);
+    }
+}
+
+internal void
+td__bench_count(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        size_t n = td_string_view_count(a->view, '\n');
+        td_do_not_optimize(&n);
+    }
+}
+
+internal void
+td__bench_parse_u64(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String_View v = a->view;
+        u64 n = 0;
+        td_string_view_parse_u64(&v, &n);
+        td_do_not_optimize(&n);
+    }
+}
+
+internal void
+td__bench_parse_f64(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String_View v = a->view;
+        f64 n = 0;
+        td_string_view_parse_f64(&v, &n);
+        td_do_not_optimize(&n);
+    }
+}
+
+internal void
+td__bench_read_file(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        TD_String s = {0};
+        rewind(a->fp);
+        td_read_file_to_string(&s, a->fp);
+        td_do_not_optimize(s.data);
+        td_string_clear(&s);
+    }
+}
+
+internal void
+td__bench_writer(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        td_writer_write_view(&a->writer, a->view);
+    }
+}
+
+internal void
+td__bench_string_pool(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    TD_String_Pool pool;
+
+    td_string_pool_init(&pool, (size_t)1 << 20);
+    for (u64 i = 0; i < iters; i++) {
+        TD_String s = td_string_pool_get(&pool, a->size);
+        td_do_not_optimize(s.data);
+        td_string_pool_put(&pool, &s);
+    }
+    td_string_pool_release(&pool);
+}
+
+internal void
+td__bench_pool(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    TD_Pool pool;
+
+    td_pool_init(&pool, a->size);
+    for (u64 i = 0; i < iters; i++) {
+        void *o = td_pool_get(&pool);
+        td_do_not_optimize(o);
+        td_pool_put(&pool, o);
+    }
+    td_pool_release(&pool);
+}
+
+internal void
+td__bench_slab(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        void *o = td_slab_alloc(a->size);
+        td_do_not_optimize(o);
+        td_slab_free(o);
+    }
+}
+
+internal void
+td__bench_malloc(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        void *o = malloc(a->size);
+        td_do_not_optimize(o);
+        free(o);
+    }
+}
+
+internal void
+td__bench_aligned(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    for (u64 i = 0; i < iters; i++) {
+        void *o = td_aligned_alloc(a->size, TD_CACHELINE);
+        td_do_not_optimize(o);
+        td_aligned_free(o);
+    }
+}
+
+internal void
+td__bench_arena(void *p, u64 iters)
+{
+    TD__Bench_Arg *a = p;
+    TD_Arena arena;
+
+    td_arena_init(&arena, (size_t)1 << 30);
+    for (u64 i = 0; i < iters; i++) {
+        void *o = td_arena_push(&arena, a->size);
+        td_do_not_optimize(o);
+        if ((i & 1023) == 1023) td_arena_reset(&arena, 0);
+    }
+    td_arena_free(&arena);
+}
+
+internal void
+td__bench_spsc(void *p, u64 iters)
+{
+    struct { u64 *data; size_t alloc; TD_Ring_Index head, tail; } q;
+    bool ok;
+    u64 v = 0;
+
+    (void)p;
+    td_spsc_init(&q, 1024);
+    for (u64 i = 0; i < iters; i++) {
+        td_spsc_push(&q, i, ok);
+        td_spsc_pop(&q, v, ok);
+    }
+    td_do_not_optimize(&v);
+    td_do_not_optimize(&ok);
+    td_spsc_free(&q);
+}
+
+internal void
+td__bench_mpmc(void *p, u64 iters)
+{
+    struct {
+        struct { TD_Atomic_U64 seq; u64 item; } *data;
+        size_t alloc;
+        TD_Ring_Index head, tail;
+    } q;
+    bool ok;
+    u64 v = 0;
+
+    (void)p;
+    td_mpmc_init(&q, 1024);
+    for (u64 i = 0; i < iters; i++) {
+        td_mpmc_push(&q, i, ok);
+        td_mpmc_pop(&q, v, ok);
+    }
+    td_do_not_optimize(&v);
+    td_mpmc_free(&q);
+}
+
+internal void
+td__bench_mutex(void *p, u64 iters)
+{
+    TD_Mutex m = {0};
+
+    (void)p;
+    for (u64 i = 0; i < iters; i++) {
+        td_mutex_lock(&m);
+        td_clobber();
+        td_mutex_unlock(&m);
+    }
+}
+
+internal void
+td__bench_fetch_add(void *p, u64 iters)
+{
+    TD_Atomic_U64 n = 0;
+
+    (void)p;
+    for (u64 i = 0; i < iters; i++) td_atomic_fetch_add_u64(&n, 1, TD_SEQ_CST);
+    td_do_not_optimize(&n);
+}
+
+internal void
+td__bench_time_now(void *p, u64 iters)
+{
+    (void)p;
+    for (u64 i = 0; i < iters; i++) {
+        u64 t = td_time_now_ns();
+        td_do_not_optimize(&t);
+    }
+}
+
+internal void
+td__bench_cycles(void *p, u64 iters)
+{
+    (void)p;
+    for (u64 i = 0; i < iters; i++) {
+        u64 t = td_cycles();
+        td_do_not_optimize(&t);
+    }
+}
+
+/* bytes says whether one iteration of the benchmark touches a->size bytes */
+typedef struct {
+    const char  *name;
+    TD_Bench_Fn *fn;
+    bool         bytes;
+    size_t       sizes[5];
+} TD__Bench;
+
+global_variable const TD__Bench td__benches[] = {
+    { "vec_append",            td__bench_vec_append,       false, { 16, 1024, 65536 } },
+    { "vec_append_grow",       td__bench_vec_append_grow,  false, { 16, 1024, 65536 } },
+    { "vec_append_bulk",       td__bench_vec_append_bulk,  true,  { 16, 1024, 65536 } },
+    { "string_view_equal",     td__bench_equal,            true,  { 16, 256, 4096, 65536 } },
+    { "string_view_chop",      td__bench_chop,             true,  { 16, 256, 4096, 65536 } },
+    { "string_view_trim",      td__bench_trim,             false, { 16, 256, 4096 } },
+    { "string_view_count",     td__bench_count,            true,  { 16, 256, 4096, 65536 } },
+    { "string_view_parse_u64", td__bench_parse_u64,        true,  { 4, 8, 16, 19 } },
+    { "string_view_parse_f64", td__bench_parse_f64,        true,  { 4, 8, 17, 24 } },
+    { "read_file_to_string",   td__bench_read_file,        true,  { 4096, 65536, 1 << 20 } },
+    { "writer_write_view",     td__bench_writer,           true,  { 16, 256, 4096 } },
+    { "string_pool",           td__bench_string_pool,      false, { 64, 4096 } },
+    { "pool",                  td__bench_pool,             false, { 16, 256 } },
+    { "slab_alloc",            td__bench_slab,             false, { 16, 256, 2048 } },
+    { "malloc",                td__bench_malloc,           false, { 16, 256, 2048 } },
+    { "aligned_alloc",         td__bench_aligned,          false, { 64, 4096 } },
+    { "arena_push",            td__bench_arena,            false, { 16, 256 } },
+    { "spsc",                  td__bench_spsc,             false, { 0 } },
+    { "mpmc",                  td__bench_mpmc,             false, { 0 } },
+    { "mutex",                 td__bench_mutex,            false, { 0 } },
+    { "atomic_fetch_add",      td__bench_fetch_add,        false, { 0 } },
+    { "time_now_ns",           td__bench_time_now,         false, { 0 } },
+    { "cycles",                td__bench_cycles,           false, { 0 } },
+};
+
+/* Sets up a->view as size bytes of text with a newline at the end, a->other
+   as an equal copy, and, for trim, the same copy padded with spaces */
+internal void
+td__bench_setup(TD__Bench_Arg *a, const TD__Bench *b, size_t size)
+{
+    a->size = size;
+    a->buffer = TD_MALLOC(2 * size + 1);
+    if (a->buffer == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+
+    for (size_t i = 0; i < size; i++) a->buffer[i] = (char)('a' + i % 26);
+    if (size > 0) a->buffer[size - 1] = '\n';
+    memcpy(a->buffer + size, a->buffer, size);
+
+    a->view = (TD_String_View){ a->buffer, size };
+    a->other = (TD_String_View){ a->buffer + size, size };
+
+    if (b->fn == td__bench_trim && size >= 2) {
+        memset(a->buffer + size, ' ', size);
+        a->buffer[size + size / 2] = 'x';
+    }
+
+    if (b->fn == td__bench_parse_u64 || b->fn == td__bench_parse_f64)
+        for (size_t i = 0; i < size; i++) a->buffer[i] = (char)('1' + i % 9);
+    if (b->fn == td__bench_parse_f64 && size >= 2) a->buffer[1] = '.';
+
+    if (b->fn == td__bench_read_file) {
+        a->fp = tmpfile();
+        if (a->fp != NULL) fwrite(a->buffer, 1, size, a->fp);
+    }
+
+#if defined PLATFORM_WIN
+    if (b->fn == td__bench_writer) a->fp = fopen("NUL", "wb");
+#else
+    if (b->fn == td__bench_writer) a->fp = fopen("/dev/null", "wb");
+#endif
+    if (b->fn == td__bench_writer && a->fp != NULL)
+        td_writer_init_file(&a->writer, a->fp);
+}
+
+internal void
+td__bench_teardown(TD__Bench_Arg *a, const TD__Bench *b)
+{
+    if (b->fn == td__bench_writer && a->fp != NULL) td_writer_close(&a->writer);
+    if (a->fp != NULL) fclose(a->fp);
+    TD_FREE(a->ints.data);
+    TD_FREE(a->buffer);
+    memset(a, 0, sizeof(*a));
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (strcmp(argv[i], "--counters") == 0) td_bench_counters(true);
+        else filter = argv[i];
+    }
+
+    for (size_t i = 0; i < sizeof(td__benches) / sizeof(td__benches[0]); i++) {
+        const TD__Bench *b = &td__benches[i];
+
+        for (size_t k = 0; k == 0 || (k < 5 && b->sizes[k] != 0); k++) {
+            TD__Bench_Arg a = {0};
+            char name[64];
+
+            if (b->sizes[k] != 0)
+                snprintf(name, sizeof(name), "%s/%zu", b->name, b->sizes[k]);
+            else
+                snprintf(name, sizeof(name), "%s", b->name);
+            if (filter != NULL && strstr(name, filter) == NULL) continue;
+
+            td__bench_setup(&a, b, b->sizes[k]);
+            if ((b->fn == td__bench_read_file || b->fn == td__bench_writer) &&
+                a.fp == NULL) {
+                fprintf(stderr, "%s: skipped, can't open a file\n", name);
+                td__bench_teardown(&a, b);
+                continue;
+            }
+
+            TD_Bench_Result r = td_bench_run(name, b->fn, &a,
+                                             b->bytes ? b->sizes[k] : 0);
+            if (json) td_bench_print_json(stdout, &r);
+            else td_bench_print(stdout, &r);
+            fflush(stdout);
+
+            td__bench_teardown(&a, b);
+        }
+    }
+
+    return 0;
+}
+
+#endif /* TDLIB_BENCH_MAIN */
+
+#if defined TDLIB_IMPLEMENTATION && defined TDLIB_TEST_MAIN
+
+/* The library's self tests. See Tests in PRIMER. */
+
+global_variable int td__test_failures;
+
+#define TD__EXPECT(cond)                                                      \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);        \
+            td__test_failures++;                                              \
+        }                                                                     \
+    } while (0)
+
+/* Grows and shrinks aligned blocks through realloc, walling each one in
+   with another allocation so it has to move, and checks the data survives.
+   A move that changes the distance to the alignment slides the data; both
+   directions have to happen for the test to mean anything. */
+internal void
+td__test_aligned_realloc(void)
+{
+    static const size_t aligns[] = { 64, 256, 4096 };
+    enum { STEPS = 500 };
+    void *walls[STEPS] = {0};
+    bool up = false, down = false;
+
+    for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+        size_t size = 1;
+        u8 *p = td_aligned_alloc(size, aligns[a]);
+        TD__EXPECT(p != NULL);
+        if (p == NULL) return;
+        p[0] = 0;
+
+        for (u32 i = 1; i < STEPS; i++) {
+            size_t next = 1 + (i * 7919u) % 20000;
+            u32 offset = ((TD__Aligned_Header *)p - 1)->offset;
+
+            u8 *q = td_aligned_realloc(p, next, aligns[a]);
+            TD__EXPECT(q != NULL);
+            if (q == NULL) { td_aligned_free(p); p = NULL; break; }
+            TD__EXPECT(((uintptr_t)q & (aligns[a] - 1)) == 0);
+            walls[i] = malloc(1 + i * 37 % 500);
+
+            bool intact = true;
+            for (size_t k = 0; k < size && k < next; k++)
+                if (q[k] != (u8)(k * 31 + i - 1)) intact = false;
+            TD__EXPECT(intact);
+
+            u32 moved = ((TD__Aligned_Header *)q - 1)->offset;
+            if (moved > offset) up = true;
+            if (moved < offset) down = true;
+
+            for (size_t k = 0; k < next; k++) q[k] = (u8)(k * 31 + i);
+            p = q;
+            size = next;
+        }
+
+        td_aligned_free(p);
+        for (u32 i = 1; i < STEPS; i++) { free(walls[i]); walls[i] = NULL; }
+    }
+
+    TD__EXPECT(up && down);
+}
+
+typedef struct {
+    TD__Job_Deque *deque;
+    TD_Atomic_U32 *taken;
+    TD_Atomic_U32  done;
+} TD__Test_Deque;
+
+internal void
+td__test_deque_thief(void *p)
+{
+    TD__Test_Deque *t = p;
+    TD_Job job;
+
+    for (;;) {
+        bool done = td_atomic_load_u32(&t->done, TD_ACQUIRE);
+        if (td__deque_steal(t->deque, &job))
+            td_atomic_fetch_add_u32(&t->taken[(uintptr_t)job.arg], 1, TD_RELAXED);
+        else if (done)
+            break;
+    }
+}
+
+/* The owner pushes and pops at the bottom while three thieves steal from the
+   top. Every job has to come out exactly once, including the last one in the
+   deque that the owner and the thieves race for. */
+internal void
+td__test_deque_steal(void)
+{
+    enum { JOBS = 200000, THIEVES = 3 };
+    TD_Job_Pool *pool = td_job_pool_create(THIEVES);
+    TD_Job_Group group = {0};
+    TD__Test_Deque t = {0};
+    TD_Job job = {0}, got;
+
+    t.deque = TD_MALLOC(sizeof(*t.deque));
+    t.taken = TD_MALLOC(JOBS * sizeof(*t.taken));
+    if (t.deque == NULL || t.taken == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memset(t.deque, 0, sizeof(*t.deque));
+    memset((void *)t.taken, 0, JOBS * sizeof(*t.taken));
+
+    for (u32 i = 0; i < THIEVES; i++)
+        td_job_submit(pool, &group, td__test_deque_thief, &t);
+
+    for (uintptr_t i = 0; i < JOBS; i++) {
+        job.arg = (void *)i;
+        while (!td__deque_push(t.deque, job))
+            if (td__deque_pop(t.deque, &got))
+                td_atomic_fetch_add_u32(&t.taken[(uintptr_t)got.arg], 1, TD_RELAXED);
+        if (i % 3 == 0 && td__deque_pop(t.deque, &got))
+            td_atomic_fetch_add_u32(&t.taken[(uintptr_t)got.arg], 1, TD_RELAXED);
+    }
+    while (td__deque_pop(t.deque, &got))
+        td_atomic_fetch_add_u32(&t.taken[(uintptr_t)got.arg], 1, TD_RELAXED);
+
+    td_atomic_store_u32(&t.done, 1, TD_RELEASE);
+    td_job_wait(pool, &group);
+    td_job_pool_destroy(pool);
+
+    u32 wrong = 0;
+    for (u32 i = 0; i < JOBS; i++)
+        if (td_atomic_load_u32(&t.taken[i], TD_RELAXED) != 1) wrong++;
+    TD__EXPECT(wrong == 0);
+
+    TD_FREE((void *)t.taken);
+    TD_FREE(t.deque);
+}
+
+typedef struct {
+    struct {
+        struct { TD_Atomic_U64 seq; u64 item; } *data;
+        size_t        alloc;
+        TD_Ring_Index head, tail;
+    } queue;
+    TD_Atomic_U64 *seen;
+    TD_Atomic_U32  producers;
+    TD_Atomic_U64  popped;
+    TD_Atomic_U32  failed;
+} TD__Test_Mpmc;
+
+enum { TD__TEST_MPMC_ITEMS = 50000, TD__TEST_MPMC_PRODUCERS = 2 };
+
+/* Items are producer << 32 | n. What one consumer gets from one producer
+   has to come in order. */
+internal void
+td__test_mpmc_consumer(void *p)
+{
+    TD__Test_Mpmc *t = p;
+    u64 total = (u64)TD__TEST_MPMC_ITEMS * TD__TEST_MPMC_PRODUCERS;
+    u32 next[TD__TEST_MPMC_PRODUCERS] = {0};
+    u64 item = 0;
+    bool ok;
+
+    while (td_atomic_load_u64(&t->popped, TD_RELAXED) < total) {
+        td_mpmc_pop(&t->queue, item, ok);
+        if (!ok) {
+            td__thread_yield();
+            continue;
+        }
+
+        u32 from = (u32)(item >> 32), n = (u32)item;
+        if (from >= TD__TEST_MPMC_PRODUCERS || n < next[from]) {
+            td_atomic_store_u32(&t->failed, 1, TD_RELAXED);
+        } else {
+            next[from] = n + 1;
+            td_atomic_fetch_add_u64(&t->seen[(u64)from * TD__TEST_MPMC_ITEMS + n],
+                                    1, TD_RELAXED);
+        }
+        td_atomic_fetch_add_u64(&t->popped, 1, TD_RELAXED);
+    }
+}
+
+internal void
+td__test_mpmc_producer(void *p)
+{
+    TD__Test_Mpmc *t = p;
+    u32 from = td_atomic_fetch_add_u32(&t->producers, 1, TD_RELAXED);
+    bool ok;
+
+    for (u32 n = 0; n < TD__TEST_MPMC_ITEMS; n++) {
+        for (;;) {
+            td_mpmc_push(&t->queue, (u64)from << 32 | n, ok);
+            if (ok) break;
+            td__thread_yield();
+        }
+    }
+}
+
+/* Two producers and two consumers through a small ring whose positions
+   start just short of 2^64, so head, tail and every cell's seq wrap
+   around zero while it is busy. Every item has to come out once. */
+internal void
+td__test_mpmc_wrap(void)
+{
+    TD_Job_Pool *pool = td_job_pool_create(3);
+    TD_Job_Group group = {0};
+    TD__Test_Mpmc t = {0};
+    u64 start = (u64)0 - 1000;
+
+    td_mpmc_init(&t.queue, 64);
+    for (size_t i = 0; i < t.queue.alloc; i++)
+        t.queue.data[i].seq = start + ((i - start) & (t.queue.alloc - 1));
+    t.queue.head.value = t.queue.tail.value = start;
+
+    t.seen = TD_MALLOC((size_t)TD__TEST_MPMC_ITEMS * TD__TEST_MPMC_PRODUCERS *
+                       sizeof(*t.seen));
+    if (t.seen == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    memset((void *)t.seen, 0, (size_t)TD__TEST_MPMC_ITEMS * TD__TEST_MPMC_PRODUCERS *
+                      sizeof(*t.seen));
+
+    td_job_submit(pool, &group, td__test_mpmc_consumer, &t);
+    td_job_submit(pool, &group, td__test_mpmc_consumer, &t);
+    td_job_submit(pool, &group, td__test_mpmc_producer, &t);
+    td__test_mpmc_producer(&t);
+    td_job_wait(pool, &group);
+    td_job_pool_destroy(pool);
+
+    u32 wrong = 0;
+    for (size_t i = 0; i < (size_t)TD__TEST_MPMC_ITEMS * TD__TEST_MPMC_PRODUCERS; i++)
+        if (td_atomic_load_u64(&t.seen[i], TD_RELAXED) != 1) wrong++;
+    TD__EXPECT(wrong == 0);
+    TD__EXPECT(!td_atomic_load_u32(&t.failed, TD_RELAXED));
+    TD__EXPECT(td_atomic_load_u64(&t.queue.tail.value, TD_RELAXED) < start);
+
+    TD_FREE((void *)t.seen);
+    td_mpmc_free(&t.queue);
+}
+
+/* Buckets have to tile 0 .. 2^64 - 1 without gaps or overlap, every value
+   has to land in the bucket whose bounds contain it, and no bucket may be
+   wider than its low end allows for TD_HISTBITS bits of precision. */
+internal void
+td__test_histogram_buckets(void)
+{
+    u32 wrong = 0;
+
+    for (size_t i = 0; i < TD__HIST_BUCKETS; i++) {
+        u64 low = td__hist_low(i), high = td__hist_high(i);
+
+        if (low > high) wrong++;
+        if (td__hist_index(low) != i || td__hist_index(high) != i) wrong++;
+        if (i > 0 && low != td__hist_high(i - 1) + 1) wrong++;
+        if (high - low > (low >> TD_HISTBITS)) wrong++;
+    }
+    TD__EXPECT(wrong == 0);
+    TD__EXPECT(td__hist_low(0) == 0);
+    TD__EXPECT(td__hist_high(TD__HIST_BUCKETS - 1) == (u64)-1);
+
+    TD_Histogram *h = TD_MALLOC(sizeof(*h));
+    if (h == NULL) {
+        TD_PANIC("TD_MALLOC: out of memory");
+    }
+    td_histogram_init(h);
+    for (u64 v = 1; v <= 100000; v++) td_histogram_record(h, v * 1000);
+
+    /* The exact answers are 50000000, 99000000 and 99900000. */
+    u64 p50 = td_histogram_percentile(h, 50);
+    u64 p99 = td_histogram_percentile(h, 99);
+    u64 p999 = td_histogram_percentile(h, 99.9);
+    TD__EXPECT(p50 >= 50000000 && p50 - 50000000 <= 50000000 >> TD_HISTBITS);
+    TD__EXPECT(p99 >= 99000000 && p99 - 99000000 <= 99000000 >> TD_HISTBITS);
+    TD__EXPECT(p999 >= 99900000 && p999 - 99900000 <= 99900000 >> TD_HISTBITS);
+    TD__EXPECT(td_histogram_percentile(h, 100) == 100000000);
+    TD__EXPECT(td_histogram_percentile(h, 0) == 1000);
+    TD_FREE(h);
+}
+
+/* Parses s both ways and counts a mismatch in the bits, in whether it
+   parsed, or in how much of it was consumed. NaNs only have to both be
+   NaN. */
+internal void
+td__test_parse_float(char *s, u32 *wrong)
+{
+    TD_String_View v = td_string_view_from_cstr(s);
+    char *end;
+    f64 d = 0, want_d = strtod(s, &end);
+    f32 f = 0, want_f = strtof(s, NULL);
+    bool ok = td_string_view_parse_f64(&v, &d);
+
+    if (ok != (end != s) || (ok && v.data != end)) {
+        (*wrong)++;
+        return;
+    }
+    if (!ok) return;
+    if (memcmp(&d, &want_d, sizeof(d)) != 0 && !(d != d && want_d != want_d))
+        (*wrong)++;
+
+    v = td_string_view_from_cstr(s);
+    td_string_view_parse_f32(&v, &f);
+    if (memcmp(&f, &want_f, sizeof(f)) != 0 && !(f != f && want_f != want_f))
+        (*wrong)++;
+}
+
+/* Edge cases by hand, then shortest and long renderings of random bit
+   patterns and random digit strings, all against strtod and strtof. */
+internal void
+td__test_parse_floats(void)
+{
+    static char *fixed[] = {
+        "0", "-0", "1", "1.5", "-2.25e-3", ".5", "5.", "e5", ".", "-", ".e1",
+        "1e", "1e+", "1e-5x", "inf", "-Infinity", "nan", "NaN", "infx",
+        "1.7976931348623157e308", "1.7976931348623159e308", "2e308",
+        "4.9e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+        "1e-400", "9007199254740993", "9007199254740992.5",
+        "123456789012345678901234567890",
+        "2.2250738585072011e-308", "2.2250738585072014e-308",
+        "3.4028235e38", "3.4028236e38", "1.17549435e-38", "1.4e-45",
+        "0.1", "0.2", "0.3", "1e23", "8.589973e9", "7.2057594037927933e16",
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "9223372036854775808", "18446744073709551615", "18446744073709551616",
+        "000000000000000000000000000000001.5", "12345678901234567890",
+        "0.00000000000000000000000000000000000",
+    };
+    u64 state = 0x9E3779B97F4A7C15ull;
+    u32 wrong = 0;
+    char buf[128];
+
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+        td__test_parse_float(fixed[i], &wrong);
+
+    for (u32 i = 0; i < 200000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        u64 bits = state;
+        f64 x;
+        memcpy(&x, &bits, sizeof(x));
+        if (x != x || x - x != 0) continue;
+
+        switch (i % 3) {
+        case 0:
+            snprintf(buf, sizeof(buf), "%.*g", (int)(1 + state % 17), x);
+            break;
+        case 1:
+            snprintf(buf, sizeof(buf), "%.40e", x);
+            break;
+        default: {
+            size_t k = 0, n = 1 + state % 30, dot = (state >> 8) % (n + 1);
+            if (state >> 63) buf[k++] = '-';
+            for (size_t d = 0; d < n; d++) {
+                if (d == dot) buf[k++] = '.';
+                buf[k++] = (char)('0' + (state >> (d * 2 % 56)) % 10);
+            }
+            snprintf(buf + k, sizeof(buf) - k, "e%d", (int)(state >> 40 & 1023) - 512);
+        } break;
+        }
+        td__test_parse_float(buf, &wrong);
+    }
+
+    TD__EXPECT(wrong == 0);
+}
+
+typedef struct {
+    const char *name;
+    void      (*fn)(void);
+} TD__Test;
+
+global_variable const TD__Test td__tests[] = {
+    { "aligned_realloc",   td__test_aligned_realloc },
+    { "deque_steal",       td__test_deque_steal },
+    { "mpmc_wrap",         td__test_mpmc_wrap },
+    { "histogram_buckets", td__test_histogram_buckets },
+    { "parse_floats",      td__test_parse_floats },
+};
+
+int
+main(int argc, char **argv)
+{
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(td__tests) / sizeof(td__tests[0]); i++) {
+        const TD__Test *t = &td__tests[i];
+        if (filter != NULL && strstr(t->name, filter) == NULL) continue;
+
+        int before = td__test_failures;
+        t->fn();
+        printf("%-24s %s\n", t->name, td__test_failures == before ? "ok" : "FAILED");
+        fflush(stdout);
+        if (td__test_failures != before) failed++;
+    }
+
+    return failed != 0;
+}
+
+#endif /* TDLIB_TEST_MAIN */